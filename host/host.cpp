@@ -0,0 +1,106 @@
+#include "host.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "critical.h"
+#include "events.h"
+#include "timer_sim.h"
+
+
+/** ARDUINO CORE **/
+
+unsigned long millis() { return (unsigned long)(simNow() / (F_CPU / 1000)); }
+unsigned long micros() { return (unsigned long)(simNow() / (F_CPU / 1000000)); }
+
+void delay(unsigned long ms) { simAdvance((uint64_t)ms * (F_CPU / 1000)); }
+void yield() { }
+
+// The interrupt service routines are only ever called from within the
+// simulation, so there is nothing to mask.
+void noInterrupts() { }
+void interrupts() { }
+
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(const char* s)  { return write((const uint8_t*)s, strlen(s)); }
+size_t Print::print(char c)         { return write((uint8_t)c); }
+size_t Print::print(int i)          { return printf("%d", i); }
+size_t Print::println(const char* s) { return print(s) + print('\n'); }
+size_t Print::println(int i)        { return printf("%d\n", i); }
+
+size_t Print::printf(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (n < 0)
+    return 0;
+  return write((const uint8_t*)buffer, strnlen(buffer, sizeof(buffer)));
+}
+
+
+size_t Serial_::write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+size_t Serial_::write(const uint8_t *buffer, size_t size)
+  { return fwrite(buffer, 1, size, stdout); }
+
+Serial_ Serial;
+
+
+/** PB.INO **/
+
+Configuration configuration;
+
+uint32_t hostCriticalWrites = 0;
+
+size_t Critical::write(uint8_t c) {
+  hostCriticalWrites += 1;
+  return fwrite(&c, 1, 1, stderr);
+}
+
+size_t Critical::write(const uint8_t *buffer, size_t size) {
+  hostCriticalWrites += (uint32_t)size;
+  return fwrite(buffer, 1, size, stderr);
+}
+
+Critical critical;
+
+void isrMeasure() {
+  postEvent(eventMeasure);
+}
+
+
+/** CHECKS **/
+
+namespace {
+  int checksFailed = 0;
+}
+
+void check(bool ok, const char* format, ...) {
+  if (ok)
+    return;
+
+  checksFailed += 1;
+  va_list args;
+  va_start(args, format);
+  fputs("FAIL: ", stdout);
+  vprintf(format, args);
+  fputs("\n", stdout);
+  va_end(args);
+}
+
+int checkResult() {
+  if (checksFailed)
+    printf("%d checks failed\n", checksFailed);
+  return checksFailed ? 1 : 0;
+}
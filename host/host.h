@@ -0,0 +1,24 @@
+#ifndef _INCLUDE_HOST_H_
+#define _INCLUDE_HOST_H_
+
+#include <stdint.h>
+
+/*
+  The host shim: the parts of the Arduino core, and of pb.ino, that the
+  timing and clock code needs, so that it can run on a Linux box against the
+  timer simulation (see timer_sim.h).
+
+  Also the little that the host tests share for reporting.
+*/
+
+extern uint32_t hostCriticalWrites;
+  // bytes written to critical, which should be none
+
+void check(bool ok, const char* format, ...)
+  __attribute__ ((format (printf, 2, 3)));
+  // report a failed check, which fails the test
+
+int checkResult();
+  // the exit status for main(): zero if all checks passed
+
+#endif // _INCLUDE_HOST_H_
@@ -0,0 +1,444 @@
+#include "replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <Arduino.h>
+
+#include "clock.h"
+#include "config.h"
+#include "events.h"
+#include "midi.h"
+#include "timer_sim.h"
+
+
+/** CLOCK TRACES **/
+
+ClockTrace::ClockTrace(int pb)
+  : count(0), perBeat(pb), beatCount(0), lastAt(0), lastBpm(120), seed(1)
+  { }
+
+double ClockTrace::jitter(double us) {
+  // a fixed sequence, so that runs are repeatable
+  seed = seed * 1103515245u + 12345u;
+  double r = (double)((seed >> 8) & 0xffff) / 0x8000 - 1.0;
+  return r * us;
+}
+
+void ClockTrace::add(uint64_t at) {
+  if (count < maxEdges)
+    this->at[count++] = at;
+  lastAt = at;
+}
+
+void ClockTrace::addBeat(uint64_t at) {
+  if (beatCount < maxEdges)
+    beatAt[beatCount++] = at;
+}
+
+void ClockTrace::steady(double bpm, double beats, double jitterUs) {
+  double interval = ticksPerSecond * 60.0 / bpm / perBeat;
+  int n = (int)(beats * perBeat + 0.5);
+  double t = (double)(count ? lastAt + interval : ticksPerSecond / 10);
+    // the first edge comes a little after power up
+
+  for (int i = 0; i < n; ++i, t += interval) {
+    if (count % perBeat == 0)
+      addBeat((uint64_t)t);
+    add((uint64_t)(t + jitter(jitterUs) * (ticksPerSecond / 1000000)));
+  }
+  lastAt = (uint64_t)(t - interval);
+  lastBpm = bpm;
+}
+
+void ClockTrace::ramp(double fromBpm, double toBpm, double beats,
+    bool exponential)
+{
+  int n = (int)(beats * perBeat + 0.5);
+  double t = (double)(count ? lastAt : ticksPerSecond / 10);
+
+  for (int i = 0; i < n; ++i) {
+    double f = (double)i / n;
+    double bpm = exponential
+      ? fromBpm * pow(toBpm / fromBpm, f)
+      : fromBpm + (toBpm - fromBpm) * f;
+    t += ticksPerSecond * 60.0 / bpm / perBeat;
+    if (count % perBeat == 0)
+      addBeat((uint64_t)t);
+    add((uint64_t)t);
+  }
+  lastBpm = toBpm;
+}
+
+void ClockTrace::gap(double beats) {
+  lastAt += (uint64_t)(ticksPerSecond * 60.0 / lastBpm * beats);
+}
+
+
+/** REPLAY **/
+
+namespace {
+  const int maxRises = ClockTrace::maxEdges;
+  uint64_t  beatRises[maxRises];
+  int       beatRiseCount = 0;
+
+  void recordEdge(const SimEdge& edge) {
+    if (edge.output == simOutputB && edge.rising && beatRiseCount < maxRises)
+      beatRises[beatRiseCount++] = edge.at;
+  }
+
+  divisor_t edgeDivisors[ClockTrace::maxEdges];
+  uint64_t  stopAt = 0;
+  bool      replayMidi = false;
+
+  void takeEvents(ReplayStats& stats, bool running) {
+    Event event;
+    while (takeEvent(event)) {
+      switch (event.type) {
+        case eventClockPerplexed: stats.perplexes += 1;  break;
+        case eventClockLocked:    stats.locks += 1;      break;
+        case eventClockLost:
+          if (running)
+            stats.losts += 1;
+          else if (stats.stopMs < 0)
+            stats.stopMs = (double)(simNow() - stopAt) / ticksPerMs;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  // the index of the edge nearest to t, among every step'th edge
+  int nearestEdge(const ClockTrace& clock, uint64_t t, int step) {
+    int lo = 0;
+    int hi = (clock.count - 1) / step;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (clock.at[mid * step] < t)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo > 0 && clock.at[lo * step] > t
+        && t - clock.at[(lo - 1) * step] < clock.at[lo * step] - t)
+      lo -= 1;
+    return lo * step;
+  }
+
+  // the index of the master beat nearest to t
+  int nearestBeat(const uint64_t* beats, int count, uint64_t t) {
+    int lo = 0;
+    int hi = count - 1;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (beats[mid] < t)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo > 0 && beats[lo] > t && t - beats[lo - 1] < beats[lo] - t)
+      lo -= 1;
+    return lo;
+  }
+
+  uint64_t  fallbackBeats[ClockTrace::maxEdges];
+
+  double ticksToUs(int64_t ticks) {
+    return (double)ticks * 1000000.0 / ticksPerSecond;
+  }
+
+  bool            midiLoop = false;
+  uint64_t        midiFrame = 0;
+  uint64_t        midiBusy = 0;
+  bool            midiStamped = false;
+  MidiParser      midiParser;
+  MidiClockStamps midiStamps;
+  int             midiPending = 0;    // clocks arrived, but not yet parsed
+
+  void midiArrives() {
+    const uint8_t packet[] = { 0x0f, 0xf8, 0x00, 0x00 };
+    midiStamps.received(packet, sizeof(packet), micros());
+    midiPending += 1;
+  }
+
+  void pollMidi() {
+    // as pb.ino does
+    for (; midiPending > 0; --midiPending) {
+      if (midiParser.parse(0xf8) != midiMsgClock)
+        continue;
+      uint32_t at;
+      if (!midiStamps.take(at) || !midiStamped)
+        at = micros();
+      midiClock(at);
+    }
+  }
+
+  void runMidiLoop(uint64_t until) {
+    // poll every millisecond, except when busy
+    uint64_t t = simNow() - simNow() % ticksPerMs + ticksPerMs;
+    for (;; t += ticksPerMs) {
+      uint64_t inFrame = t % midiFrame;
+      if (inFrame < midiBusy)
+        t += midiBusy - inFrame;
+      if (t >= until)
+        break;
+      simAdvance(t - simNow());
+      pollMidi();
+    }
+    simAdvance(until - simNow());
+  }
+
+  void advanceTo(uint64_t t) {
+    if (midiLoop)
+      runMidiLoop(t);
+    else
+      simAdvance(t - simNow());
+  }
+
+  State replayState() {
+    State state;
+    state.settings = { 2, 4, 4, 3, 1, 4 };  // two measures of 4/4
+    state.memoryIndex = 0;
+    state.syncMode = syncFixed;
+    state.userBpm = 120;
+    return state;
+  }
+}
+
+
+void replayBegin(SyncMode sync, bpm_t presetBpm, bool pllSync,
+    bool extendedRange)
+{
+  configuration = Configuration();
+  configuration.options.pllSync = pllSync;
+  configuration.options.extendedBpmRange = extendedRange;
+
+  Event event;
+  while (takeEvent(event))
+    ;
+
+  simOnEdge(recordEdge);
+  beatRiseCount = 0;
+  replayMidi = sync == syncMidiUSB;
+  midiLoop = false;
+  midiParser = MidiParser();
+  midiStamps = MidiClockStamps();
+  midiPending = 0;
+
+  State state = replayState();
+  state.syncMode = sync;
+  state.userBpm = presetBpm;
+
+  initializeTimers();
+  initializeClock();
+
+  setBpm(state.userBpm);
+  setSync(state.syncMode);
+  resetTiming(state);
+}
+
+void replayClock(const ClockTrace& clock, ReplayStats& stats,
+    ReplayHook hook)
+{
+  stats = ReplayStats();
+  stats.lockBeat = -1;
+  stats.minDivisor = 0xffff;
+  stats.stopMs = -1;
+
+  for (int i = 0; i < clock.count; ++i) {
+    advanceTo(clock.at[i]);
+    if (hook)
+      hook(i);
+    if (midiLoop)
+      midiArrives();
+    else if (replayMidi)
+      midiClock(micros());
+    else
+      simExtClk();
+    edgeDivisors[i] = simQuantumDivisor();
+    takeEvents(stats, true);
+  }
+
+  // run on until the clock is lost, a millisecond at a time, so that the
+  // time it took can be seen
+  stopAt = simNow();
+  for (int ms = 0; ms < 20000 && stats.stopMs < 0; ++ms) {
+    advanceTo(simNow() + ticksPerMs);
+    takeEvents(stats, false);
+  }
+
+  const IsrStats& sequence = simSequenceIsrStats();
+  const IsrStats& watchdog = simWatchdogIsrStats();
+  stats.sequenceIsrRuns = sequence.runs();
+  stats.sequenceIsrMeanCycles = sequence.meanCycles();
+  stats.sequenceIsrMaxCycles = sequence.mostCycles();
+  stats.watchdogIsrRuns = watchdog.runs();
+  stats.watchdogIsrMaxCycles = watchdog.mostCycles();
+
+  stats.edges = clock.count;
+  stats.beats = (clock.count + clock.perBeat - 1) / clock.perBeat;
+  if (clock.count < 2)
+    return;
+
+  // without the master's own beats, every perBeat'th edge is one
+  const uint64_t* beats = clock.beatAt;
+  int beatCount = clock.beatCount;
+  if (beatCount == 0) {
+    for (int i = 0; i < clock.count; i += clock.perBeat)
+      fallbackBeats[beatCount++] = clock.at[i];
+    beats = fallbackBeats;
+  }
+
+  // only the beats while the clock ran count
+  uint64_t first = clock.at[0];
+  uint64_t last = clock.at[clock.count - 1]
+    + (clock.at[clock.count - 1] - clock.at[clock.count - 2]) / 2;
+
+  double beatUs = ticksToUs((int64_t)(clock.at[clock.count - 1] - first))
+    / (clock.count - 1) * clock.perBeat;
+  stats.toleranceUs = beatUs / 480;
+
+  // the clock starts on the first edge, so that beat says nothing
+  int lockRise = -1;
+  for (int r = 0; r < beatRiseCount; ++r) {
+    uint64_t t = beatRises[r];
+    if (t <= first || t > last)
+      continue;
+    int64_t phase = (int64_t)(t - clock.at[nearestEdge(clock, t, 1)]);
+    if (fabs(ticksToUs(phase)) > stats.toleranceUs)
+      lockRise = -1;
+    else if (lockRise < 0)
+      lockRise = r;
+  }
+  if (lockRise < 0)
+    return;
+
+  uint64_t lockAt = beatRises[lockRise];
+  stats.lockBeat = nearestBeat(beats, beatCount, lockAt);
+  stats.lockMs = (double)(lockAt - first) / ticksPerMs;
+  stats.minBeatOffsetUs = 1e9;
+  stats.maxBeatOffsetUs = -1e9;
+
+  // past the last beat of the master, the nearest beat would be one that
+  // never came
+  uint64_t lastBeat = beats[beatCount - 1] + (beatCount > 1
+    ? (beats[beatCount - 1] - beats[0]) / (uint64_t)(beatCount - 1) / 2
+    : (last - first) / 2);
+
+  int n = 0;
+  double sumPhase = 0;
+  for (int r = lockRise; r < beatRiseCount && beatRises[r] <= last; ++r) {
+    uint64_t t = beatRises[r];
+    double phase = fabs(ticksToUs(
+      (int64_t)(t - clock.at[nearestEdge(clock, t, 1)])));
+    stats.maxPhaseUs = max(stats.maxPhaseUs, phase);
+    sumPhase += phase;
+    n += 1;
+
+    if (t > lastBeat)
+      continue;
+    double offset = ticksToUs(
+      (int64_t)(t - beats[nearestBeat(beats, beatCount, t)]));
+    stats.minBeatOffsetUs = min(stats.minBeatOffsetUs, offset);
+    stats.maxBeatOffsetUs = max(stats.maxBeatOffsetUs, offset);
+  }
+  stats.meanPhaseUs = sumPhase / n;
+
+  for (int i = 0; i < clock.count; ++i) {
+    if (clock.at[i] < lockAt)
+      continue;
+    stats.minDivisor = min(stats.minDivisor, edgeDivisors[i]);
+    stats.maxDivisor = max(stats.maxDivisor, edgeDivisors[i]);
+  }
+}
+
+void replayMidiLoop(double frameMs, double busyMs, bool stamped) {
+  midiLoop = replayMidi;
+  midiFrame = (uint64_t)(frameMs * ticksPerMs);
+  midiBusy = (uint64_t)(busyMs * ticksPerMs);
+  midiStamped = stamped;
+}
+
+divisor_t replayDivisor(int edge) {
+  return edgeDivisors[edge];
+}
+
+void printStats(const char* name, const ReplayStats& s) {
+  printf("%-28s %5d edges, %2d perplexed, %2d lost, stop %4.0fms | ",
+    name, s.edges, s.perplexes, s.losts, s.stopMs);
+  if (s.lockBeat < 0) {
+    printf("never locked\n");
+    return;
+  }
+  printf("locked at beat %3d (%6.0fms), phase max %6.0fus mean %5.0fus, "
+         "beat offset %6.0f~%6.0fus, divisor %5d~%5d\n",
+    s.lockBeat, s.lockMs, s.maxPhaseUs, s.meanPhaseUs,
+    s.minBeatOffsetUs, s.maxBeatOffsetUs, s.minDivisor, s.maxDivisor);
+}
+
+void printIsrStats(const char* name, const ReplayStats& s) {
+  printf("%-28s sequence isr %6u runs, cycles mean %5.0f max %5u | "
+         "watchdog isr %5u runs, cycles max %5u\n",
+    name, s.sequenceIsrRuns, s.sequenceIsrMeanCycles, s.sequenceIsrMaxCycles,
+    s.watchdogIsrRuns, s.watchdogIsrMaxCycles);
+}
+
+
+/** RECORDED TRACES **/
+
+bool replayTraceFile(const char* path, SyncMode sync) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+
+  // The trace gives the sequence period it was recorded with, and the
+  // capture has to wrap at the same point, so find settings that match.
+  unsigned period = 0;
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "capture trace: %*d samples, sequence period %u",
+        &period) == 1)
+      break;
+  }
+
+  State state = replayState();
+  state.syncMode = sync;
+  bool found = false;
+  for (uint8_t m = 1; m <= 8 && !found; ++m) {
+    for (uint8_t b = 1; b <= 16 && !found; ++b) {
+      state.settings.numberMeasures = m;
+      state.settings.beatsPerMeasure = b;
+      Timing timing;
+      computePeriods(state, timing);
+      found = timing.sequence == period;
+    }
+  }
+  if (!found) {
+    fprintf(stderr, "%s: no settings give a sequence period of %u\n",
+      path, period);
+    fclose(f);
+    return false;
+  }
+
+  replayBegin(sync, 120);
+  resetTiming(state);
+
+  // The samples go straight to the estimator, so no time passes, and the
+  // watchdog never fires.
+  int samples = 0;
+  unsigned s, w;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "trace %u %u", &s, &w) == 2) {
+      isrClockCapture(s, w);
+      samples += 1;
+    }
+  }
+  fclose(f);
+
+  printf("%s: replayed %d samples\n", path, samples);
+  dumpClock();
+  return true;
+}
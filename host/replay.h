@@ -0,0 +1,121 @@
+#ifndef _INCLUDE_REPLAY_H_
+#define _INCLUDE_REPLAY_H_
+
+#include <stdint.h>
+
+#include "state.h"
+#include "timer_hw.h"
+
+/*
+  Replays an external clock into the clock estimator in clock.cpp, running
+  on the timer simulation, and measures how well the outputs follow it.
+
+  A clock is a list of edge times, in CPU ticks, and of the master's beats.
+  The beats are where the master meant them, before any jitter, doubled or
+  missing edges; if none are given, the first edge, and every perBeat edges
+  after it, is a beat. The beat output, B, is set to quarter notes, and its
+  rising edges are compared to the master:
+    - the phase is B against the nearest clock edge, which is what the
+      estimator locks to;
+    - the beat offset is B against the nearest master beat, which is off by
+      whole clocks if the outputs started on the wrong edge.
+
+  The simulated cycles of the interrupt service routines are reported too,
+  from the timer simulation's cost model, see timer_sim.cpp.
+  The edges may be taken from a trace recorded on the device, see
+  replayTraceFile(), or made up with ClockTrace.
+*/
+
+const uint64_t ticksPerSecond = 48000000;
+const uint64_t ticksPerMs = ticksPerSecond / 1000;
+
+struct ClockTrace {
+  static const int maxEdges = 16384;
+
+  uint64_t  at[maxEdges];
+  int       count;
+  int       perBeat;
+
+  uint64_t  beatAt[maxEdges];
+  int       beatCount;
+
+  ClockTrace(int perBeat);
+
+  void steady(double bpm, double beats, double jitterUs = 0);
+  void ramp(double fromBpm, double toBpm, double beats, bool exponential);
+    // the tempo changes linearly, or exponentially, with the beats
+  void gap(double beats);
+    // no edges for a while, at the last tempo
+  void add(uint64_t at);
+  void addBeat(uint64_t at);
+    // steady() and ramp() add the beats, add() doesn't
+
+private:
+  uint64_t  lastAt;
+  double    lastBpm;
+  uint32_t  seed;
+
+  double    jitter(double us);
+};
+
+
+struct ReplayStats {
+  int       edges;
+  int       beats;            // master beats heard
+
+  int       perplexes;        // from the events
+  int       losts;            // while the clock was running
+  int       locks;
+
+  double    stopMs;           // from the last edge to losing the clock
+
+  double    toleranceUs;      // a beat / 480, as in clock.cpp
+  int       lockBeat;         // from which the phase held, -1 if never
+  double    lockMs;           // from the first edge to that beat
+
+  // all these are once locked
+  double    maxPhaseUs;
+  double    meanPhaseUs;
+  double    minBeatOffsetUs;
+  double    maxBeatOffsetUs;
+  divisor_t minDivisor;
+  divisor_t maxDivisor;
+
+  // from the timer simulation, over the whole replay
+  uint32_t  sequenceIsrRuns;
+  double    sequenceIsrMeanCycles;
+  uint32_t  sequenceIsrMaxCycles;
+  uint32_t  watchdogIsrRuns;
+  uint32_t  watchdogIsrMaxCycles;
+};
+
+void replayBegin(SyncMode, bpm_t presetBpm, bool pllSync = false,
+  bool extendedRange = false);
+  // resets the simulation and the clock, as at power up
+
+typedef void (*ReplayHook)(int edge);
+
+void replayClock(const ClockTrace&, ReplayStats&, ReplayHook = nullptr);
+  // replays, then runs on without the clock until it is lost
+  // With syncMidiUSB, the edges are MIDI clocks, given to midiClock(). The
+  // hook, if any, is called just before each edge.
+
+void replayMidiLoop(double frameMs, double busyMs, bool stamped);
+  // With syncMidiUSB, gives the clocks to midiClock() as loop() in pb.ino
+  // does: each is stamped as it arrives, but only parsed when loop() polls,
+  // every millisecond except for the first busyMs of every frameMs, when it
+  // is redrawing the display. Unless stamped, the clocks are taken to arrive
+  // when parsed. Until this is called, each is given as it arrives.
+
+divisor_t replayDivisor(int edge);
+  // the quantum divisor just after that edge of the last replay
+
+void printStats(const char* name, const ReplayStats&);
+void printIsrStats(const char* name, const ReplayStats&);
+
+
+bool replayTraceFile(const char* path, SyncMode);
+  // replays a trace dumped by clock.cpp with RECORD_CAPTURES, straight into
+  // isrClockCapture(), then dumps the clock
+
+#endif // _INCLUDE_REPLAY_H_
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+/*
+  replay                    runs the synthetic clocks, and prints the stats
+  replay [-pll] trace PPQN  replays a trace dumped from the device
+*/
+
+namespace {
+  struct Case {
+    const char* name;
+    int         perBeat;
+    double      bpm;
+    double      jitterUs;
+  };
+
+  const Case cases[] = {
+    { "1 ppqn, 120 bpm",            1, 120,    0 },
+    { "4 ppqn, 120 bpm",            4, 120,    0 },
+    { "24 ppqn, 120 bpm",          24, 120,    0 },
+    { "24 ppqn, 120 bpm, jitter",  24, 120,  500 },
+    { "24 ppqn, 97.3 bpm",         24, 97.3,   0 },
+    { "24 ppqn, 280 bpm",          24, 280,    0 },
+    { "48 ppqn, 60 bpm, jitter",   48, 60,   300 },
+  };
+
+  SyncMode syncForRate(int perBeat) {
+    return (SyncMode)(syncExternalFlag | perBeat);
+  }
+
+  void runCases(bool pll) {
+    for (const Case& c : cases) {
+      static ClockTrace clock(1);
+      clock = ClockTrace(c.perBeat);
+      clock.steady(c.bpm, 32, c.jitterUs);
+
+      ReplayStats stats;
+      replayBegin(syncForRate(c.perBeat), 120, pll);
+      replayClock(clock, stats);
+      printStats(c.name, stats);
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  bool pll = argc > 1 && strcmp(argv[1], "-pll") == 0;
+  if (pll) {
+    argc -= 1;
+    argv += 1;
+  }
+
+  if (argc == 3)
+    return replayTraceFile(argv[1], syncForRate(atoi(argv[2]))) ? 0 : 1;
+
+  if (argc != 1) {
+    fprintf(stderr, "usage: replay [-pll] [trace ppqn]\n");
+    return 2;
+  }
+
+  runCases(pll);
+  return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef _INCLUDE_HOST_ARDUINO_H_
+#define _INCLUDE_HOST_ARDUINO_H_
+
+/*
+  Just enough of the Arduino core for the timing and clock code to build on
+  a Linux box. Time comes from the timer simulation, see host.cpp.
+
+  As on the SAMD21 core, min(), max() and constrain() are macros, so any
+  C++ library headers must be included before this one.
+*/
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <Print.h>
+
+#define F_CPU 48000000L
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void yield();
+
+void noInterrupts();
+void interrupts();
+
+class Serial_ : public Print {
+public:
+  virtual size_t write(uint8_t);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+
+  void begin(unsigned long) { }
+  operator bool() { return true; }
+};
+
+extern Serial_ Serial;
+
+#endif // _INCLUDE_HOST_ARDUINO_H_
@@ -0,0 +1,21 @@
+#ifndef _INCLUDE_HOST_PRINT_H_
+#define _INCLUDE_HOST_PRINT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Print {
+public:
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+
+  size_t print(const char*);
+  size_t print(char);
+  size_t print(int);
+  size_t println(const char* = "");
+  size_t println(int);
+
+  size_t printf(const char* format, ...);
+};
+
+#endif // _INCLUDE_HOST_PRINT_H_
@@ -0,0 +1,181 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <Arduino.h>
+
+#include "clock.h"
+#include "host.h"
+#include "replay.h"
+#include "timer_hw.h"
+#include "timer_sim.h"
+
+/*
+  Tests of the tempo conversions, and the reported tempo, in hundredths of
+  a BPM, against the floating point versions they replaced: the divisors
+  must be identical, and the tempo the same to within rounding.
+
+  Also a benchmark of each, though on the host both are in hardware, so it
+  only shows that the integer versions are no slower. On the M0, the float
+  ones are soft-float, and far slower.
+*/
+
+namespace {
+  // the floating point versions, as they were in timer_hw.cpp and clock.cpp
+  const float cpuFactor = 60.0f * F_CPU / Q_PER_B;
+
+  float divisorToBpm(divisor_t divisor) {
+    return cpuFactor / (float)divisor;
+  }
+
+  divisor_t divisorFromBpm(float bpm) {
+    return (divisor_t)(roundf(cpuFactor / bpm));
+  }
+
+  struct FloatStatus {
+    float reportedBpmf = 0;
+
+    bpm_t update(divisor_t targetDivisor) {
+      auto targetBpmf = divisorToBpm(targetDivisor);
+      if (fabsf(targetBpmf - reportedBpmf) < 1.0f)
+        reportedBpmf = (10.0f * reportedBpmf + targetBpmf) / 11.0f;
+      else
+        reportedBpmf = targetBpmf;
+      return (bpm_t)(roundf(reportedBpmf));
+    }
+  };
+
+
+  void testFromBpm() {
+    // every whole BPM of the extended range, and the running limits
+    int differ = 0;
+    for (bpm_t bpm = 10; bpm <= 900; ++bpm) {
+      struct { bpm100_t bpm100; float bpmf; } cases[] = {
+        { bpm * 100u, (float)bpm },
+        { bpm * 105u, bpm * 1.05f },
+        { bpm * 95u,  bpm * 0.95f },
+      };
+      for (auto c : cases) {
+        divisor_t got = divisorFromBpm100(c.bpm100);
+        divisor_t want = divisorFromBpm(c.bpmf);
+        if (got != want && differ++ < 10)
+          check(false, "from bpm: %u.%02u gave %u, not %u",
+            c.bpm100 / 100, c.bpm100 % 100, got, want);
+      }
+    }
+    printf("from bpm: %d differ\n", differ);
+  }
+
+  void testToBpm() {
+    // every divisor that can be set, to within 0.01 BPM
+    int differ = 0;
+    for (uint32_t d = divisorFromBpm(900 * 1.05f); d <= 0xffff; ++d) {
+      bpm100_t got = divisorToBpm100((divisor_t)d);
+      long want = lroundf(100.0f * divisorToBpm((divisor_t)d));
+      if (labs((long)got - want) > 1 && differ++ < 10)
+        check(false, "to bpm: %u gave %u.%02u, not %ld.%02ld",
+          d, got / 100, got % 100, want / 100, want % 100);
+    }
+    printf("to bpm: %d differ\n", differ);
+  }
+
+  void testReported() {
+    // The reported tempo slews towards small changes, and jumps to large
+    // ones. Where the float version is very near half a BPM, either
+    // rounding will do, and changes of very nearly 1 BPM are avoided.
+    replayBegin(syncFixed, 120);
+    FloatStatus model;
+
+    srandom(16);
+    uint32_t beatMicros = 500000;
+    int updates = 0;
+    int nearHalf = 0;
+    for (int step = 0; step < 2000; ++step) {
+      int r = (int)(random() % 100);
+      if (r < 5)
+        beatMicros = 200000 + (uint32_t)(random() % 1800000);   // a jump
+      else if (r < 50)
+        beatMicros += (uint32_t)(random() % 4001) - 2000;       // a drift
+      beatMicros = constrain(beatMicros, 200000u, 2000000u);
+      divisor_t target = divisorFromBeatMicros(beatMicros);
+      if (fabsf(fabsf(divisorToBpm(target) - model.reportedBpmf) - 1.0f)
+          < 0.01f) {
+        // too near the threshold to say whether it slews or jumps
+        beatMicros += 1000;
+        target = divisorFromBeatMicros(beatMicros);
+      }
+      setBeatPeriod(beatMicros);
+
+      int hold = (int)(random() % 30);
+      for (int i = 0; i <= hold; ++i) {
+        simAdvance(F_CPU / 10);   // ClockStatus updates ten times a second
+        bpm_t got = ClockStatus::current().bpm;
+        bpm_t want = model.update(target);
+        ++updates;
+
+        float fraction = model.reportedBpmf - floorf(model.reportedBpmf);
+        if (fabsf(fraction - 0.5f) < 0.02f) {
+          ++nearHalf;
+          if (got + 1 < want || got > want + 1)
+            check(false, "reported: %u, not %u (%.3f)", got, want,
+              model.reportedBpmf);
+        }
+        else if (got != want)
+          check(false, "reported: %u, not %u (%.3f)", got, want,
+            model.reportedBpmf);
+      }
+    }
+    printf("reported: %d updates, %d near half a BPM\n", updates, nearHalf);
+  }
+
+
+  volatile uint32_t sink;
+
+  double nsPer(clock_t start, int n) {
+    return 1e9 * (double)(clock() - start) / CLOCKS_PER_SEC / n;
+  }
+
+  void benchmark() {
+    const int n = 10000000;
+
+    clock_t start = clock();
+    for (int i = 0; i < n; ++i)
+      sink = divisorToBpm100((divisor_t)(900 + (i & 0x3fff)));
+    double toBpm100 = nsPer(start, n);
+
+    start = clock();
+    for (int i = 0; i < n; ++i)
+      sink = (uint32_t)roundf(divisorToBpm((divisor_t)(900 + (i & 0x3fff))));
+    double toBpm = nsPer(start, n);
+
+    start = clock();
+    FloatStatus model;
+    for (int i = 0; i < n; ++i)
+      sink = model.update((divisor_t)(2380 + (i & 0x1f)));
+    double slewf = nsPer(start, n);
+
+    uint32_t reported = 0;
+    start = clock();
+    for (int i = 0; i < n; ++i) {
+      uint32_t target = divisorToBpm100((divisor_t)(2380 + (i & 0x1f))) << 4;
+      reported = (10 * reported + target + 5) / 11;
+      sink = (reported + (50 << 4)) / (100 << 4);
+    }
+    double slew = nsPer(start, n);
+
+    printf("benchmark, ns per call on the host:\n"
+      "  divisorToBpm100 %5.1f  |  float %5.1f\n"
+      "  slew            %5.1f  |  float %5.1f\n",
+      toBpm100, toBpm, slew, slewf);
+  }
+}
+
+int main() {
+  testFromBpm();
+  testToBpm();
+  testReported();
+  benchmark();
+
+  return checkResult();
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+
+#include "clock.h"
+#include "host.h"
+#include "replay.h"
+
+/*
+  Tests of syncAuto: for each supported rate, a steady clock must be taken
+  at the right rate, lock within a bar of starting, and have the outputs on
+  the master's beats, even though the first few edges went to detecting it.
+
+  Every case starts from the same tempo, as the rate chosen depends on it.
+  A clock too far from that tempo is taken at another rate, as documented
+  with syncAuto, and runs the outputs at that tempo instead.
+*/
+
+namespace {
+  const bpm_t preset = 120;
+
+  void detect(int perBeat, double bpm, bool pll = false, int takenAs = 0) {
+    if (takenAs == 0)
+      takenAs = perBeat;
+
+    ClockTrace clock(perBeat);
+    clock.steady(bpm, 32);
+
+    ReplayStats stats;
+    replayBegin(syncAuto, preset, pll);
+    replayClock(clock, stats);
+
+    char name[64];
+    snprintf(name, sizeof(name), "auto, %d ppqn, %g bpm, from %d%s",
+      perBeat, bpm, preset, pll ? ", pll" : "");
+    printStats(name, stats);
+
+    // at another rate, the outputs would run at another tempo
+    double taken = bpm * perBeat / takenAs;
+    double divisor = ticksPerSecond * 60.0 / (taken * Q_PER_B);
+    divisor_t last = replayDivisor(clock.count - 1);
+    check(last > divisor * 0.99 && last < divisor * 1.01,
+      "%s: divisor %d, not %.0f", name, last, divisor);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock", name);
+    if (takenAs != perBeat)
+      return;   // the master's beats aren't the outputs' beats
+
+    check(stats.lockBeat >= 0 && stats.lockBeat <= 4,
+      "%s: locked at beat %d", name, stats.lockBeat);
+    check(stats.maxPhaseUs < stats.toleranceUs,
+      "%s: phase error %.0fus", name, stats.maxPhaseUs);
+    check(-stats.minBeatOffsetUs < stats.toleranceUs
+        && stats.maxBeatOffsetUs < stats.toleranceUs,
+      "%s: beats off by %.0f~%.0fus", name,
+      stats.minBeatOffsetUs, stats.maxBeatOffsetUs);
+  }
+}
+
+int main() {
+  detect(1, 120);
+  detect(2, 100);
+  detect(4, 140);
+  detect(8, 120);
+  detect(24, 120);
+  detect(24, 120, true);
+  detect(24, 90);
+  detect(48, 110);
+
+  // 48 clocks per beat at 100 bpm would be nearer the preset
+  detect(24, 200);
+
+  // the ambiguous: 24 at 150 is nearer the preset than 48 at 75, and 8 at
+  // 87 nearer than 4 at 174
+  detect(48, 75, false, 24);
+  detect(4, 174, false, 8);
+
+  return checkResult();
+}
@@ -0,0 +1,122 @@
+#include <stdio.h>
+
+#include "clock.h"
+#include "host.h"
+#include "midi.h"
+#include "replay.h"
+
+/*
+  Tests of USB MIDI sync: the parser on a fake byte stream, the arrival
+  stamps, and clocks that loop() only gets to after a display redraw.
+*/
+
+namespace {
+  void testParser() {
+    const uint8_t bytes[] = {
+      0xf8,                 // clock
+      0x90, 0x40, 0xf8,     // a clock in the middle of a note on
+      0x7f,
+      0xf2, 0x10, 0xf8,     // and in the middle of a song position
+      0x02,
+      0xfa, 0xf8,           // start
+      0x40, 0x00,           // data without a status, ignored
+      0xfc, 0xfb,           // stop, continue
+      0xfe,                 // active sensing, ignored
+    };
+    const MidiMessage expected[] = {
+      midiMsgClock,
+      midiMsgNone, midiMsgNone, midiMsgClock,
+      midiMsgNone,
+      midiMsgNone, midiMsgNone, midiMsgClock,
+      midiMsgPosition,
+      midiMsgStart, midiMsgClock,
+      midiMsgNone, midiMsgNone,
+      midiMsgStop, midiMsgContinue,
+      midiMsgNone,
+    };
+
+    MidiParser parser;
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+      MidiMessage m = parser.parse(bytes[i]);
+      check(m == expected[i], "parser: byte %d (%02x) gave %d, not %d",
+        (int)i, bytes[i], m, expected[i]);
+      if (m == midiMsgPosition)
+        check(parser.position() == 0x110,
+          "parser: position %d", parser.position());
+    }
+  }
+
+  void testStamps() {
+    const uint8_t transfer[] = {
+      0x09, 0x90, 0x40, 0x7f,     // note on
+      0x0f, 0xf8, 0x00, 0x00,     // clock
+      0x0f, 0xfa, 0x00, 0x00,     // start
+      0x0f, 0xf8, 0x00, 0x00,     // clock
+    };
+    const uint8_t clock[] = { 0x0f, 0xf8, 0x00, 0x00 };
+
+    MidiClockStamps stamps;
+    uint32_t at;
+    stamps.received(transfer, sizeof(transfer), 1000);
+    stamps.received(clock, sizeof(clock), 2000);
+    check(stamps.take(at) && at == 1000, "stamps: first clock");
+    check(stamps.take(at) && at == 1000, "stamps: second clock");
+    check(stamps.take(at) && at == 2000, "stamps: third clock");
+
+    // a clock the interrupt missed gets no stamp, and the next is in step
+    check(!stamps.take(at), "stamps: a missed clock was stamped");
+    stamps.received(clock, sizeof(clock), 3000);
+    check(stamps.take(at) && at == 3000, "stamps: not back in step");
+
+    // if loop() falls far behind, the oldest stamps are lost
+    for (uint32_t i = 0; i < 20; ++i)
+      stamps.received(clock, sizeof(clock), 4000 + i);
+    int lost = 0;
+    for (uint32_t i = 0; i < 20; ++i) {
+      if (!stamps.take(at))
+        lost += 1;
+      else
+        check(at == 4000 + i, "stamps: clock %d stamped %u", (int)i, at);
+    }
+    check(lost == 5, "stamps: %d lost", lost);
+  }
+
+  // loop() redraws the display at 20Hz, which takes about 12ms
+  void redrawing(double bpm, bool stamped, bool pll) {
+    ClockTrace clock(24);
+    clock.steady(bpm, 32);
+
+    ReplayStats stats;
+    replayBegin(syncMidiUSB, 120, pll);
+    replayMidiLoop(50, 12, stamped);
+    replayClock(clock, stats);
+
+    char name[64];
+    snprintf(name, sizeof(name), "midi, %g bpm, redrawing%s%s",
+      bpm, stamped ? ", stamped" : "", pll ? ", pll" : "");
+    printStats(name, stats);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock", name);
+    check(stats.lockBeat >= 0 && stats.lockBeat <= 4,
+      "%s: locked at beat %d", name, stats.lockBeat);
+    check(stats.maxPhaseUs < stats.toleranceUs,
+      "%s: phase error %.0fus", name, stats.maxPhaseUs);
+    check(-stats.minBeatOffsetUs < stats.toleranceUs
+        && stats.maxBeatOffsetUs < stats.toleranceUs,
+      "%s: beats off by %.0f~%.0fus", name,
+      stats.minBeatOffsetUs, stats.maxBeatOffsetUs);
+  }
+}
+
+int main() {
+  testParser();
+  testStamps();
+
+  redrawing(120, true, false);
+  redrawing(120, true, true);
+  redrawing(250, true, false);
+  redrawing(250, true, true);
+
+  return checkResult();
+}
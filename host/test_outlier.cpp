@@ -0,0 +1,128 @@
+#include <math.h>
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "clock.h"
+#include "config.h"
+#include "host.h"
+#include "replay.h"
+
+/*
+  Tests of dropping outlying clock intervals: a single late, early, doubled
+  or missing edge in a steady clock must not make it perplexed, nor move
+  the tempo or the phase. An edge later than the watchdog allows for, or
+  missing, is a dropout, so only the flywheel carries the clock over it.
+
+  Had the interval gone into the average, a doubled edge alone would take
+  the tempo 2% off, for the two beats the capture buffer spans, and the
+  phase half a clock off with it. Each case is compared to a model of that
+  plain running mean, fed the same edges, and the simulated cycles of the
+  interrupt service routines are compared to those of the undisturbed
+  clock.
+*/
+
+namespace {
+  const int perBeat = 24;
+  const double bpm = 120;
+  const double interval = ticksPerSecond * 60.0 / bpm / perBeat;
+
+  // an edge between beats, well after locking
+  const int disturbed = 8 * perBeat + 7;
+
+  const double divisor = ticksPerSecond * 60.0 / (bpm * Q_PER_B);
+
+  // The plain running mean, as captureSum was, over the two beats of the
+  // capture buffer: the furthest its divisor strays from the true one,
+  // once the buffer is full.
+  double plainMeanExcursion(const ClockTrace& clock) {
+    const int n = 2 * perBeat;
+    double most = 0;
+    for (int i = n; i < clock.count; ++i) {
+      double mean = (double)(clock.at[i] - clock.at[i - n]) / n;
+      double d = mean * perBeat / Q_PER_B;
+      most = max(most, fabs(d - divisor));
+    }
+    return most;
+  }
+
+  ReplayStats undisturbed;
+
+  void replayUndisturbed() {
+    ClockTrace clock(perBeat);
+    clock.steady(bpm, 24);
+    replayBegin(sync24ppqn, 120);
+    replayClock(clock, undisturbed);
+    printStats("outlier, undisturbed", undisturbed);
+  }
+
+  enum Disturbance { late, veryLate, early, doubled, missing };
+
+  void disturb(const char* name, Disturbance how, int flywheelBeats = 0) {
+    ClockTrace steady(perBeat);
+    steady.steady(bpm, 24);
+
+    ClockTrace clock(perBeat);
+    for (int i = 0; i < steady.beatCount; ++i)
+      clock.addBeat(steady.beatAt[i]);
+      // the master's beats stay where they were
+    for (int i = 0; i < steady.count; ++i) {
+      uint64_t at = steady.at[i];
+      if (i == disturbed) {
+        switch (how) {
+          case late:      at += (uint64_t)(interval * 0.15); break;
+          case veryLate:  at += (uint64_t)(interval * 0.4);  break;
+          case early:     at -= (uint64_t)(interval * 0.4);  break;
+          case doubled:   clock.add(at - (uint64_t)(interval / 2));  break;
+          case missing:   continue;
+        }
+      }
+      clock.add(at);
+    }
+
+    ReplayStats stats;
+    replayBegin(sync24ppqn, 120);
+    configuration.flywheelBeats = flywheelBeats;
+    replayClock(clock, stats);
+    printStats(name, stats);
+
+    double plain = plainMeanExcursion(clock);
+    double robust = max(divisor - stats.minDivisor, stats.maxDivisor - divisor);
+    printf("%-28s divisor off by up to %4.1f%%, plain mean %4.1f%%\n", "",
+      100 * robust / divisor, 100 * plain / divisor);
+    printIsrStats("", stats);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock", name);
+    check(stats.lockBeat >= 0 && stats.lockBeat <= 4,
+      "%s: locked at beat %d", name, stats.lockBeat);
+    check(stats.minDivisor > divisor * 0.995
+        && stats.maxDivisor < divisor * 1.005,
+      "%s: divisor %d~%d, not %.0f", name,
+      stats.minDivisor, stats.maxDivisor, divisor);
+    check(stats.maxPhaseUs < stats.toleranceUs,
+      "%s: phase error %.0fus", name, stats.maxPhaseUs);
+    check(stats.minBeatOffsetUs > -stats.toleranceUs
+        && stats.maxBeatOffsetUs < stats.toleranceUs,
+      "%s: beat offset %.0f~%.0fus", name,
+      stats.minBeatOffsetUs, stats.maxBeatOffsetUs);
+
+    if (how == doubled || how == missing)
+      check(plain > divisor / 100,
+        "%s: the plain mean was only %.0f off", name, plain);
+    check(stats.sequenceIsrMaxCycles <= undisturbed.sequenceIsrMaxCycles,
+      "%s: sequence isr took %u cycles, %u undisturbed", name,
+      stats.sequenceIsrMaxCycles, undisturbed.sequenceIsrMaxCycles);
+  }
+}
+
+int main() {
+  replayUndisturbed();
+  disturb("outlier, late edge", late);
+  disturb("outlier, early edge", early);
+  disturb("outlier, doubled edge", doubled);
+  disturb("outlier, very late edge, fly", veryLate, 1);
+  disturb("outlier, missing edge, fly", missing, 1);
+
+  return checkResult();
+}
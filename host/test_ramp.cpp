@@ -0,0 +1,100 @@
+#include <stdio.h>
+
+#include "clock.h"
+#include "host.h"
+#include "replay.h"
+
+/*
+  Tests of following a master that ramps its tempo, as DAW tempo automation
+  does: linearly or exponentially, up or down. Once the slope is learnt,
+  the outputs must stay locked to the master's clocks, and on its beats,
+  for the rest of the ramp.
+
+  The slope is learnt over some tens of clocks, so within a bar at 8 or
+  more clocks per beat, but only after a few bars at 4. At 1 or 2 clocks
+  per beat, a ramp of a few bars is over before it is learnt.
+*/
+
+namespace {
+  SyncMode syncFor(int perBeat) {
+    switch (perBeat) {
+      case 4:   return sync4ppqn;
+      case 8:   return sync8ppqn;
+      case 48:  return sync48ppqn;
+      default:  return sync24ppqn;
+    }
+  }
+
+  void ramp(int perBeat, double fromBpm, double toBpm, double beats,
+      bool exponential, bool pll, int lockBy = 4)
+  {
+    ClockTrace clock(perBeat);
+    clock.ramp(fromBpm, toBpm, beats, exponential);
+
+    ReplayStats stats;
+    replayBegin(syncFor(perBeat), (bpm_t)fromBpm, pll);
+    replayClock(clock, stats);
+
+    char name[80];
+    snprintf(name, sizeof(name), "%d ppqn, %g to %g bpm in %g, %s%s",
+      perBeat, fromBpm, toBpm, beats, exponential ? "exp" : "linear",
+      pll ? ", pll" : "");
+    printStats(name, stats);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock", name);
+    check(stats.lockBeat >= 0 && stats.lockBeat <= lockBy,
+      "%s: locked at beat %d", name, stats.lockBeat);
+    check(stats.maxPhaseUs < stats.toleranceUs,
+      "%s: phase error %.0fus", name, stats.maxPhaseUs);
+    check(-stats.minBeatOffsetUs < stats.toleranceUs
+        && stats.maxBeatOffsetUs < stats.toleranceUs,
+      "%s: beats off by %.0f~%.0fus", name,
+      stats.minBeatOffsetUs, stats.maxBeatOffsetUs);
+  }
+
+  // Where a ramp starts and stops, the slope jumps, and the phase takes a
+  // beat or two to settle again, but the clock must not be lost.
+  void rampBetween(double fromBpm, double toBpm, bool pll) {
+    ClockTrace clock(24);
+    clock.steady(fromBpm, 8);
+    clock.ramp(fromBpm, toBpm, 16, true);
+    clock.steady(toBpm, 8);
+
+    ReplayStats stats;
+    replayBegin(sync24ppqn, (bpm_t)fromBpm, pll);
+    replayClock(clock, stats);
+
+    char name[80];
+    snprintf(name, sizeof(name), "24 ppqn, %g, ramp, %g bpm%s",
+      fromBpm, toBpm, pll ? ", pll" : "");
+    printStats(name, stats);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock", name);
+    check(stats.lockBeat >= 0 && stats.lockBeat <= 8 + 16 + 4,
+      "%s: locked at beat %d", name, stats.lockBeat);
+  }
+}
+
+int main() {
+  for (int pll = 0; pll < 2; ++pll) {
+    // about 1 bpm per beat
+    ramp(24, 100, 132, 32, false, pll);
+    ramp(24, 132, 100, 32, false, pll);
+    ramp(24, 90, 140, 32, true, pll);
+    ramp(24, 140, 90, 32, true, pll);
+    ramp(8, 100, 132, 32, false, pll);
+    ramp(48, 140, 90, 32, true, pll);
+    ramp(4, 100, 132, 32, false, pll, 16);
+
+    // steep: an octave in four bars
+    ramp(24, 90, 180, 16, true, pll);
+    ramp(24, 180, 90, 16, true, pll);
+
+    rampBetween(100, 150, pll);
+    rampBetween(150, 100, pll);
+  }
+
+  return checkResult();
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host.h"
+#include "reciprocal.h"
+#include "timer_hw.h"
+#include "timing.h"
+
+/*
+  Tests of the reciprocals the interrupt routines divide with: exact for
+  every dividend below 2^31, for each divisor clock.cpp uses them with, and
+  some others.
+
+  A quotient computed by multiplying with a reciprocal that is slightly too
+  large is first wrong just below a multiple of the divisor, so checking
+  both sides of every multiple is as good as checking every dividend.
+
+  Also the division-free versions of the phase correction and the capture
+  average, against the divides they replaced in clock.cpp: over every
+  divisor the clock can run at, with the phase errors possible at each
+  rate, and over every count of the capture buffer.
+*/
+
+namespace {
+  const uint32_t limit = 0x80000000u;
+
+  const uint32_t divisors[] = {
+    // the clock in Q, at each supported rate, and the beat
+    Q_PER_B / 48, Q_PER_B / 24, Q_PER_B / 8, Q_PER_B / 4, Q_PER_B / 2,
+    Q_PER_B,
+    // and some awkward ones
+    127, 129, 255, 257, 1000, 4095, 4097, 65535,
+  };
+
+  int failures = 0;
+
+  void fail(const char* what, uint32_t q, uint32_t x, uint64_t got,
+      uint64_t want) {
+    if (failures++ < 10)
+      check(false, "%s: %u / %u gave %llu, not %llu", what, x, q,
+        (unsigned long long)got, (unsigned long long)want);
+  }
+
+  void testDivide(uint32_t q) {
+    Reciprocal r(q);
+    for (uint64_t x = q; x < limit; x += q) {
+      if (r.divide(uint32_t(x)) != x / q)
+        fail("divide", q, uint32_t(x), r.divide(uint32_t(x)), x / q);
+      if (r.divide(uint32_t(x - 1)) != (x - 1) / q)
+        fail("divide", q, uint32_t(x - 1), r.divide(uint32_t(x - 1)),
+          (x - 1) / q);
+    }
+    if (r.divide(limit - 1) != (limit - 1) / q)
+      fail("divide", q, limit - 1, r.divide(limit - 1), (limit - 1) / q);
+  }
+
+  void testRoundingDivide(uint32_t q) {
+    // rounding moves the boundaries to half way between multiples
+    Reciprocal r(q);
+    for (uint64_t x = q / 2; x + q / 2 < limit; x += q) {
+      for (uint64_t y = x - (x > 0); y <= x; ++y) {
+        uint64_t want = (y + q / 2) / q;
+        if (r.roundingDivide(uint32_t(y)) != want)
+          fail("roundingDivide", q, uint32_t(y),
+            r.roundingDivide(uint32_t(y)), want);
+      }
+    }
+  }
+
+  void testRoundingDivide8(uint32_t q) {
+    if (q <= 128)
+      return;
+    Reciprocal r(q);
+    srandom(q);
+    for (int i = 0; i < 1000000; ++i) {
+      uint32_t x = (uint32_t(random()) ^ (uint32_t(random()) << 16)) % limit;
+      uint64_t want = ((uint64_t(x) << 8) + q / 2) / q;
+      uint64_t got = r.roundingDivide8(x);
+      if (got + 1 < want || got > want + 1)
+        fail("roundingDivide8", q, x, got, want);
+    }
+  }
+
+  // the divisors the clock runs at, over the extended range, as in clock.cpp
+  const uint32_t runningMin = divisorFromBpm100(900 * 105);
+  const uint32_t runningMax = divisorFromBpm100(10 * 95);
+
+  void testPhaseCorrect(uint32_t perBeat) {
+    // phase errors are within half a clock, either way: every one of them
+    // at 8 or more clocks per beat, and a sweep through them at fewer
+    Reciprocal r(Q_PER_B);
+    const int32_t clkQ = int32_t(Q_PER_B / perBeat);
+    const int32_t step = clkQ > 1260 ? clkQ / 1260 + 1 : 1;
+    const double r3 = 1.0 / (8.0 * perBeat * perBeat * perBeat);
+    int differ = 0;
+    uint32_t worst = 0;
+    for (int32_t p = -clkQ / 2; p < clkQ / 2; p += step) {
+      for (uint32_t x = runningMin; x <= runningMax; ++x) {
+        uint32_t got = r.scaleByComplement(x, p);
+        uint32_t want = (x * Q_PER_B + (Q_PER_B - p) / 2) / (Q_PER_B - p);
+          // as clock.cpp divided
+        uint32_t error = got > want ? got - want : want - got;
+        uint32_t change = want > x ? want - x : x - want;
+        if (error)
+          ++differ;
+        worst = error > worst ? error : worst;
+        if (error > 3 + change * r3)
+          fail("phaseCorrect", Q_PER_B - p, x * Q_PER_B, got, want);
+      }
+    }
+    printf("phaseCorrect, %2u per beat: %d differ, by up to %u\n",
+      perBeat, differ, worst);
+  }
+
+  void testAverage() {
+    // every count, and a sweep through the sums of that many divisors at
+    // which the rounding changes, and just below
+    const int size = 96;
+    CountReciprocals<size> c;
+    c.initialize();
+    long differ = 0;
+    for (int n = 1; n <= size; ++n) {
+      uint64_t maxSum = uint64_t(n) * (runningMax << 8);
+      for (uint64_t q = 0; q * n <= maxSum; q += 7) {
+        uint32_t boundary = uint32_t(q * n + (n + 1) / 2);
+        for (uint32_t x = boundary - 1; x <= boundary; ++x) {
+          uint32_t got = c.roundingDivide(x, n);
+          uint32_t want = (x + uint32_t(n) / 2) / uint32_t(n);
+            // as clock.cpp divided
+          if (got != want) {
+            ++differ;
+            if (got != want + 1)
+              fail("captureAverage8", uint32_t(n), x, got, want);
+          }
+        }
+      }
+    }
+    printf("captureAverage8: %ld differ, by one\n", differ);
+  }
+}
+
+int main() {
+  for (auto q : divisors) {
+    testDivide(q);
+    testRoundingDivide(q);
+    testRoundingDivide8(q);
+  }
+  printf("reciprocals: %d divisors, %d failures\n",
+    int(sizeof(divisors) / sizeof(divisors[0])), failures);
+
+  const uint32_t rates[] = { 48, 24, 8, 4, 2, 1 };
+  for (auto perBeat : rates)
+    testPhaseCorrect(perBeat);
+  testAverage();
+
+  return checkResult();
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "clock.h"
+#include "config.h"
+#include "host.h"
+#include "replay.h"
+
+/*
+  Regression cases for the clock estimator: a steady clock must lock within
+  a bar, with the outputs on the master's beats, hold its phase, not go
+  perplexed, and stop when it does.
+*/
+
+namespace {
+  ClockTrace clock(24);
+
+  void steadyClock(SyncMode sync, int perBeat, double bpm, double jitterUs,
+      bool pll, bool extended = false, bpm_t preset = 120)
+  {
+    clock = ClockTrace(perBeat);
+    clock.steady(bpm, 32, jitterUs);
+
+    ReplayStats stats;
+    replayBegin(sync, preset, pll, extended);
+    replayClock(clock, stats);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%d ppqn, %g bpm%s%s%s",
+      perBeat, bpm, jitterUs ? ", jitter" : "", pll ? ", pll" : "",
+      extended ? ", ext" : "");
+    printStats(name, stats);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock", name);
+    check(stats.lockBeat >= 0 && stats.lockBeat <= 4,
+      "%s: locked at beat %d", name, stats.lockBeat);
+    check(stats.maxPhaseUs < stats.toleranceUs,
+      "%s: phase error %.0fus", name, stats.maxPhaseUs);
+    check(stats.stopMs >= 0, "%s: never stopped", name);
+    check(-stats.minBeatOffsetUs < stats.toleranceUs
+        && stats.maxBeatOffsetUs < stats.toleranceUs,
+      "%s: beats off by %.0f~%.0fus", name,
+      stats.minBeatOffsetUs, stats.maxBeatOffsetUs);
+  }
+
+  // The master jumps by just over half a clock, so the outputs are nearly
+  // half a clock behind. At the slow end of the extended range, that is a
+  // large phase error on a large divisor.
+  void phaseJump(bool pll) {
+    clock = ClockTrace(1);
+    clock.steady(10, 6);
+    clock.gap(0.52);
+    clock.steady(10, 24);
+
+    ReplayStats stats;
+    replayBegin(sync1ppqn, 30, pll, true);
+    replayClock(clock, stats);
+
+    const char* name = pll ? "1 ppqn, 10 bpm, jump, pll"
+                           : "1 ppqn, 10 bpm, jump";
+    printStats(name, stats);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock", name);
+    check(stats.lockBeat >= 0, "%s: never locked", name);
+
+    // the outputs are behind, so the first edge after the jump must speed
+    // them up by a good part of the phase error
+    divisor_t before = replayDivisor(5);
+    divisor_t after = replayDivisor(6 + 1);
+    check(after < before - before / 8,
+      "%s: divisor %d after the jump, from %d", name, after, before);
+  }
+
+  // MIDI stops while the clock is coasting through a dropout, and starts
+  // again at another tempo.
+  const int beforeStop = 4 * 24;
+
+  void stopWhileCoasting(int edge) {
+    if (edge == beforeStop) {
+      midiStop();
+      midiStart();
+    }
+  }
+
+  void pauseWhileCoasting() {
+    clock = ClockTrace(24);
+    clock.steady(120, beforeStop / 24);
+    clock.gap(1);
+    clock.steady(90, 16);
+
+    ReplayStats stats;
+    replayBegin(syncMidiUSB, 120);
+    configuration.flywheelBeats = 2;
+    replayClock(clock, stats, stopWhileCoasting);
+
+    const char* name = "midi, stop while coasting";
+    printStats(name, stats);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.lockBeat >= 0 && stats.lockBeat <= 5,
+      "%s: locked at beat %d", name, stats.lockBeat);
+    check(-stats.minBeatOffsetUs < stats.toleranceUs
+        && stats.maxBeatOffsetUs < stats.toleranceUs,
+      "%s: beats off by %.0f~%.0fus", name,
+      stats.minBeatOffsetUs, stats.maxBeatOffsetUs);
+  }
+
+  // The pll is turned off, the master changes tempo, and the pll is turned
+  // on again: it must start from the new tempo, not where it was left.
+  const int pllOff = 8 * 24;
+  const int pllOn = 16 * 24;
+
+  void togglePll(int edge) {
+    if (edge == pllOff)
+      configuration.options.pllSync = false;
+    if (edge == pllOn)
+      configuration.options.pllSync = true;
+  }
+
+  void pllToggled() {
+    clock = ClockTrace(24);
+    clock.steady(120, 10);
+    clock.steady(130, 14);
+
+    ReplayStats stats;
+    replayBegin(sync24ppqn, 120, true);
+    replayClock(clock, stats, togglePll);
+
+    const char* name = "24 ppqn, 120 then 130 bpm, pll toggled";
+    printStats(name, stats);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock", name);
+
+    double divisor = ticksPerSecond * 60.0 / (130 * Q_PER_B);
+    divisor_t lo = 0xffff, hi = 0;
+    for (int edge = pllOn; edge < clock.count; ++edge) {
+      divisor_t d = replayDivisor(edge);
+      lo = min(lo, d);
+      hi = max(hi, d);
+    }
+    check(lo > divisor * 0.98 && hi < divisor * 1.02,
+      "%s: divisor %d~%d once back on, not %.0f", name, lo, hi, divisor);
+  }
+}
+
+int main() {
+  steadyClock(sync24ppqn, 24, 120, 0, false);
+  steadyClock(sync24ppqn, 24, 120, 0, true);
+  steadyClock(sync24ppqn, 24, 120, 300, false);
+  steadyClock(sync4ppqn, 4, 174, 0, false);
+  steadyClock(sync48ppqn, 48, 75, 0, false);
+
+  // far from the preset, the outputs must still start on the master's beats
+  steadyClock(sync24ppqn, 24, 90, 0, false);
+  steadyClock(sync24ppqn, 24, 170, 0, false);
+  steadyClock(sync24ppqn, 24, 299, 0, true);
+  steadyClock(sync8ppqn, 8, 120, 0, false, false, 80);
+
+  // at the slow end of the extended range, losing the first interval
+  // means losing the clock
+  steadyClock(sync1ppqn, 1, 10.5, 0, true, true, 30);
+  steadyClock(sync1ppqn, 1, 10.5, 0, false, true, 30);
+
+  phaseJump(true);
+  phaseJump(false);
+
+  pauseWhileCoasting();
+  pllToggled();
+
+  return checkResult();
+}
@@ -0,0 +1,375 @@
+#include <stdio.h>
+
+#include "clock.h"
+#include "host.h"
+#include "replay.h"
+#include "timer_sim.h"
+
+/*
+  Tests of the timer simulation: the edges it records on the outputs, for
+  running free, staged and cancelled changes, the reset input and swing.
+  Staged changes must not move the beats off the grid they were on, even
+  at the highest tempo, where the quantum is shortest.
+  Also that it tallies interrupt cycles, and a comparison of the measure
+  interrupt's cycles with those it took when it read the count back.
+*/
+
+namespace {
+  const int maxEdges = 4096;
+
+  struct Edges {
+    uint64_t  rises[maxEdges];
+    uint64_t  falls[maxEdges];
+    int       riseCount;
+    int       fallCount;
+  };
+
+  Edges edges[4];   // indexed by SimOutput
+
+  void recordEdge(const SimEdge& edge) {
+    Edges& e = edges[edge.output];
+    if (edge.rising) {
+      if (e.riseCount < maxEdges)
+        e.rises[e.riseCount++] = edge.at;
+    } else {
+      if (e.fallCount < maxEdges)
+        e.falls[e.fallCount++] = edge.at;
+    }
+  }
+
+  bool risesAt(SimOutput output, uint64_t at) {
+    const Edges& e = edges[output];
+    for (int i = 0; i < e.riseCount; ++i)
+      if (e.rises[i] == at)
+        return true;
+    return false;
+  }
+
+  State fourFour() {
+    State state;
+    state.settings = { 2, 4, 4, 3, 1, 4 };  // two measures of 4/4, triplets
+    state.memoryIndex = 0;
+    state.syncMode = syncFixed;
+    state.userBpm = 120;
+    return state;
+  }
+
+  void start(const State& state) {
+    for (auto& e : edges) {
+      e.riseCount = 0;
+      e.fallCount = 0;
+    }
+    simOnEdge(recordEdge);
+
+    initializeTimers();
+    initializeClock();
+    setBpm(state.userBpm);
+    setSync(state.syncMode);
+    resetTiming(state);
+  }
+
+  uint64_t ticksPerBeat() {
+    return (uint64_t)simQuantumDivisor() * Q_PER_B;
+  }
+
+  void checkOnGrid(const char* name, SimOutput output, const char* outputName,
+      uint64_t origin, uint64_t period) {
+    // every rise from origin on is a whole number of periods from it
+    const Edges& e = edges[output];
+    for (int i = 0; i < e.riseCount; ++i) {
+      if (e.rises[i] < origin)
+        continue;
+      uint64_t off = (e.rises[i] - origin) % period;
+      if (off != 0) {
+        check(false, "%s: %s %d is %llu ticks off the grid", name,
+          outputName, i, (unsigned long long)off);
+        return;
+      }
+    }
+  }
+
+  void checkBeatsOnGrid(const char* name) {
+    // the first beat is short, see testFreeRunning()
+    uint64_t beat = ticksPerBeat();
+    uint64_t origin = edges[simOutputB].rises[1];
+    checkOnGrid(name, simOutputB, "beat", origin, beat);
+    checkOnGrid(name, simOutputT, "triplet", origin, beat / 3);
+  }
+
+
+  void testFreeRunning() {
+    start(fourFour());
+    simAdvance(8 * ticksPerSecond);
+
+    const Edges& s = edges[simOutputS];
+    const Edges& m = edges[simOutputM];
+    const Edges& b = edges[simOutputB];
+    const Edges& t = edges[simOutputT];
+    uint64_t beat = ticksPerBeat();
+
+    check(b.riseCount == 16, "free: %d beats in 8s at 120 bpm", b.riseCount);
+    check(m.riseCount == 4, "free: %d measures", m.riseCount);
+    check(s.riseCount == 2, "free: %d sequences", s.riseCount);
+    check(t.riseCount == 48, "free: %d triplets", t.riseCount);
+
+    // the first quantum comes early, as the timers were started before
+    // the tempo was set, so the first beat is short
+    for (int i = 2; i < b.riseCount; ++i)
+      check(b.rises[i] - b.rises[i - 1] == beat,
+        "free: beat %d is %llu ticks", i,
+        (unsigned long long)(b.rises[i] - b.rises[i - 1]));
+    for (int i = 1; i < m.riseCount; ++i)
+      check(m.rises[i] == b.rises[1] + (4 * i - 1) * beat,
+        "free: measure %d not on its beat", i);
+    for (int i = 0; i < m.riseCount; ++i)
+      check(risesAt(simOutputB, m.rises[i]),
+        "free: measure %d not on a beat", i);
+    for (int i = 0; i < s.riseCount; ++i)
+      check(risesAt(simOutputM, s.rises[i]),
+        "free: sequence %d not on a measure", i);
+    for (int i = 0; i < b.riseCount; ++i)
+      check(risesAt(simOutputT, b.rises[i]),
+        "free: beat %d not on a triplet", i);
+
+    q_t minWidth = divisorToMinWidth(simQuantumDivisor());
+    for (int i = 1; i < b.fallCount && i < b.riseCount; ++i)
+      check(b.falls[i] - b.rises[i] >= (uint64_t)minWidth * simQuantumDivisor(),
+        "free: beat %d too short", i);
+  }
+
+  void testStaged(bpm_t bpm) {
+    char name[32];
+    snprintf(name, sizeof(name), "staged, %u bpm", bpm);
+    State state = fourFour();
+    state.userBpm = bpm;
+    start(state);
+    uint64_t beat = ticksPerBeat();
+
+    simAdvance(beat * 5 + beat / 2);    // in the middle of the second measure
+
+    state.settings.beatsPerMeasure = 3;
+    updateTiming(state);
+    check(timingPending(), "%s: not pending", name);
+
+    simAdvance(beat);
+    check(timingPending(), "%s: applied before the measure boundary", name);
+    simAdvance(3 * beat);
+    check(!timingPending(), "%s: not applied at the measure boundary", name);
+
+    simAdvance(12 * beat);
+    const Edges& m = edges[simOutputM];
+    check(m.riseCount >= 5, "%s: %d measures", name, m.riseCount);
+    if (m.riseCount < 5)
+      return;
+    check(m.rises[2] - m.rises[1] == 4 * beat,
+      "%s: the change cut the second measure short", name);
+    for (int i = 3; i < m.riseCount; ++i)
+      check(m.rises[i] - m.rises[i - 1] == 3 * beat,
+        "%s: measure %d isn't 3 beats", name, i);
+
+    // the change was applied within the quantum, so no time was lost
+    checkBeatsOnGrid(name);
+  }
+
+  void testCancel() {
+    State state = fourFour();
+    start(state);
+    uint64_t beat = ticksPerBeat();
+
+    // going back before the boundary, the staged change is dropped
+    simAdvance(beat * 5 + beat / 2);
+    State changed = state;
+    changed.settings.beatsPerMeasure = 3;
+    updateTiming(changed);
+    simAdvance(beat);
+    cancelTiming(state);
+    check(!timingPending(), "cancel: still pending");
+
+    // going back after it was applied, the original is staged again
+    simAdvance(3 * beat);
+    updateTiming(changed);
+    simAdvance(4 * beat);
+    check(!timingPending(), "cancel: change not applied");
+    cancelTiming(state);
+    check(timingPending(), "cancel: original not staged again");
+    simAdvance(16 * beat);
+
+    // the dropped change would have shortened the third measure, the
+    // applied one cuts the fourth short, after which it is put back
+    const Edges& m = edges[simOutputM];
+    check(m.riseCount >= 7, "cancel: %d measures", m.riseCount);
+    if (m.riseCount < 7)
+      return;
+    check(m.rises[3] - m.rises[2] == 4 * beat,
+      "cancel: the dropped change took effect");
+    check(m.rises[4] - m.rises[3] < 4 * beat,
+      "cancel: the applied change didn't take effect");
+    for (int i = 5; i < m.riseCount; ++i)
+      check(m.rises[i] - m.rises[i - 1] == 4 * beat,
+        "cancel: measure %d isn't 4 beats", i);
+
+    checkBeatsOnGrid("cancel");
+  }
+
+  void testRescaled() {
+    // eight measures of 16/2, with M slowed to one per eight sequences,
+    // needs a coarser quantum, and so is applied right away
+    State state = fourFour();
+    state.settings = { 8, 16, 2, 3, 1, 4 };
+    start(state);
+    uint64_t beat = ticksPerBeat();
+    simAdvance(beat * 5 + beat / 2);
+
+    State slow = state;
+    slow.outputModeM = outputSequence;
+    slow.outputFactorM = -8;
+    Timing timing;
+    computePeriods(slow, timing);
+    check(quantumShift(timing) == 1, "rescaled: shift %d",
+      quantumShift(timing));
+
+    updateTiming(slow);
+    check(!timingPending(), "rescaled: left for the measure interrupt");
+    simAdvance(8 * beat);
+    checkBeatsOnGrid("rescaled");
+
+    // and back
+    updateTiming(state);
+    check(!timingPending(), "rescaled: not put back right away");
+    simAdvance(8 * beat);
+    checkBeatsOnGrid("rescaled back");
+  }
+
+  void testReset() {
+    start(fourFour());
+    uint64_t beat = ticksPerBeat();
+
+    simAdvance(beat * 2 + beat / 3);
+    uint64_t resetAt = simNow();
+    simReset();
+    simAdvance(beat);
+
+    check(risesAt(simOutputS, resetAt), "reset: S didn't restart");
+    check(risesAt(simOutputM, resetAt), "reset: M didn't restart");
+    check(risesAt(simOutputB, resetAt), "reset: B didn't restart");
+    check(risesAt(simOutputT, resetAt), "reset: T didn't restart");
+  }
+
+  void testSwing() {
+    State state = fourFour();
+    state.settings.tupletTime = 2;
+    state.settings.tupletUnit = 8;  // triplet eighths
+    state.userBpm = 300;
+    state.swing = 66;
+    state.pulseWidthB = pulseDutyHalf;
+    start(state);
+    simAdvance(4 * ticksPerSecond);
+
+    const Edges& b = edges[simOutputB];
+    uint64_t beat = ticksPerBeat();
+    uint64_t first = beat * 66 / 100;
+
+    check(b.riseCount > 8, "swing: %d beats", b.riseCount);
+    for (int i = 2; i < b.riseCount; ++i) {
+      uint64_t interval = b.rises[i] - b.rises[i - 1];
+      uint64_t expected = (i % 2) ? first : beat - first;
+      uint64_t slop = simQuantumDivisor();
+      check(interval + slop >= expected && interval <= expected + slop,
+        "swing: beat %d is %llu ticks, not %llu", i,
+        (unsigned long long)interval, (unsigned long long)expected);
+    }
+    for (int i = 1; i < b.fallCount && i < b.riseCount; ++i)
+      check(b.falls[i] - b.rises[i] <= (beat - first) / 2 + simQuantumDivisor(),
+        "swing: beat %d doesn't fit the short period", i);
+  }
+
+  void testSwingPairs() {
+    // three pairs to a sequence: each sequence starts on the longer period
+    State state = fourFour();
+    state.settings = { 2, 3, 4, 3, 1, 4 };
+    state.userBpm = 300;
+    state.swing = 66;
+    start(state);
+    simAdvance(6 * ticksPerSecond);
+
+    const Edges& s = edges[simOutputS];
+    const Edges& b = edges[simOutputB];
+    uint64_t first = 2 * ticksPerBeat() * 66 / 100;   // B swings in beats
+    uint64_t slop = simQuantumDivisor();
+
+    check(s.riseCount > 3, "swing pairs: %d sequences", s.riseCount);
+    int j = 0;
+    for (int i = 1; i < s.riseCount; ++i) {
+      while (j < b.riseCount && b.rises[j] + slop < s.rises[i])
+        ++j;
+      if (j + 1 >= b.riseCount)
+        break;
+      uint64_t interval = b.rises[j + 1] - b.rises[j];
+      check(b.rises[j] <= s.rises[i] + slop
+          && interval + slop >= first && interval <= first + slop,
+        "swing pairs: sequence %d starts a %llu tick beat, not %llu", i,
+        (unsigned long long)interval, (unsigned long long)first);
+    }
+  }
+
+  void testIsrCycles() {
+    replayBegin(sync24ppqn, 120);
+    ClockTrace clock(24);
+    clock.steady(120, 8);
+    ReplayStats stats;
+    replayClock(clock, stats);
+
+    const IsrStats& sequence = simSequenceIsrStats();
+    const IsrStats& watchdog = simWatchdogIsrStats();
+    check(sequence.runs() > (uint32_t)clock.count,
+      "isr: %u sequence runs", sequence.runs());
+    check(sequence.mostCycles() > 0, "isr: sequence cycles not tallied");
+    check(watchdog.runs() > 0, "isr: watchdog never ran");
+    check(watchdog.mostCycles() > 0, "isr: watchdog cycles not tallied");
+    dumpTimers();
+  }
+
+  void testMeasureIsr() {
+    // many short measures, at a high tempo
+    State state = fourFour();
+    state.settings = { 8, 1, 4, 3, 1, 4 };
+    state.userBpm = 300;
+
+    const char* names[] = { "read back", "shadow" };
+    double mean[2];
+    uint32_t most[2];
+    int beats[2];
+    for (int shadow = 0; shadow < 2; ++shadow) {
+      start(state);
+      simMeasureReadback(!shadow);
+      simAdvance(8 * ticksPerSecond);
+
+      const IsrStats& measure = simMeasureIsrStats();
+      mean[shadow] = measure.meanCycles();
+      most[shadow] = measure.mostCycles();
+      beats[shadow] = edges[simOutputB].riseCount;
+      printf("measure isr, %-9s: %u runs, cycles mean %.0f max %u\n",
+        names[shadow], measure.runs(), mean[shadow], most[shadow]);
+    }
+
+    check(beats[0] == beats[1], "measure isr: %d beats, %d with the shadow",
+      beats[0], beats[1]);
+    check(mean[1] < mean[0] && most[1] < most[0],
+      "measure isr: the shadow takes no fewer cycles");
+  }
+}
+
+int main() {
+  testFreeRunning();
+  testStaged(120);
+  testStaged(bpmMax);
+  testCancel();
+  testRescaled();
+  testReset();
+  testSwing();
+  testSwingPairs();
+  testIsrCycles();
+  testMeasureIsr();
+
+  return checkResult();
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "clock.h"
+#include "host.h"
+#include "replay.h"
+#include "tap_tempo.h"
+#include "timer_sim.h"
+
+/*
+  Tests of tap tempo: the estimate from steady, missed and doubled taps,
+  and that tapping lines the beats of the measure up with the taps,
+  whatever the B output is playing.
+
+  Also a benchmark of how far from the taps the outputs land.
+*/
+
+namespace {
+  void testEstimate() {
+    TapTempo taps;
+    uint32_t at = 1000;
+    taps.tap(at);
+    taps.tap(at += 500000);
+    check(!taps.ready(), "estimate: ready after two taps");
+    taps.tap(at += 500000);
+    check(taps.ready() && taps.interval() == 500000,
+      "estimate: steady taps gave %u", taps.interval());
+    taps.tap(at += 500000);
+    taps.tap(at += 500000);
+
+    taps.tap(at += 250000);   // a doubled tap
+    taps.tap(at += 250000);
+    check(taps.interval() == 500000,
+      "estimate: doubled tap gave %u", taps.interval());
+
+    taps.tap(at += 1000000);  // a missed tap
+    taps.tap(at += 500000);
+    check(taps.interval() == 500000,
+      "estimate: missed tap gave %u", taps.interval());
+
+    taps.tap(at += 3000000);
+    check(!taps.ready(), "estimate: still ready after a long pause");
+
+    TapTempo wrapping;
+    at = 0xffffff00;
+    wrapping.tap(at);
+    wrapping.tap(at += 600000);
+    wrapping.tap(at += 600000);
+    check(wrapping.interval() == 600000,
+      "estimate: across micros() wrapping gave %u", wrapping.interval());
+  }
+
+
+  const int maxRises = 256;
+  uint64_t measureRises[maxRises];
+  int measureRiseCount = 0;
+
+  void recordEdge(const SimEdge& edge) {
+    if (edge.output == simOutputM && edge.rising
+        && measureRiseCount < maxRises)
+      measureRises[measureRiseCount++] = edge.at;
+  }
+
+  // Taps four times, as ui_sync.cpp does, with each press 70ms before the
+  // release that acts on it, then checks that the measures fall on the
+  // tapped beats, to within the tolerance the replays use. The tapped beat
+  // is the beat unit of the measure, which for 5/8 is an eighth note.
+  //
+  // The tempo is a whole divisor, so may be off the taps by up to half a
+  // divisor, and the outputs drift from the taps by that much.
+  //
+  // Returns how far, in microseconds, the first measure is from the taps.
+  double tapAlong(const char* name, const State& state,
+      uint32_t interval = 600000, uint64_t phase = ticksPerSecond / 3)
+  {
+    measureRiseCount = 0;
+    simOnEdge(recordEdge);
+
+    initializeTimers();
+    initializeClock();
+    setBpm(state.userBpm);
+    setSync(state.syncMode);
+    resetTiming(state);
+    simAdvance(phase);
+
+    const uint64_t press = ticksPerSecond * 7 / 100;
+    const uint64_t ticksPerUs = ticksPerSecond / 1000000;
+    TapTempo taps;
+    uint64_t tapAt = 0;
+    for (int i = 0; i < 4; ++i) {
+      simAdvance(press);
+      tapAt = simNow() - press;
+      taps.tap((uint32_t)(tapAt / ticksPerUs));
+      if (taps.ready()) {
+        setBeatPeriod(taps.interval());
+        alignBeat(micros() - taps.lastTap());
+      }
+      simAdvance(interval * ticksPerUs - press);
+    }
+    check(taps.interval() == interval,
+      "%s: tapped %u, not %u", name, taps.interval(), interval);
+
+    int firstRise = measureRiseCount;
+    simAdvance(4 * ticksPerSecond);
+
+    uint64_t quarter = (uint64_t)interval * ticksPerUs;
+    uint64_t beat = quarter * 4 / state.settings.beatUnit;
+    uint64_t slop = quarter / 480;
+    double drift = 0.5 / divisorFromBeatMicros(interval);
+    double first = 0;
+    check(measureRiseCount > firstRise, "%s: no measures", name);
+    for (int i = firstRise; i < measureRiseCount; ++i) {
+      uint64_t off = (measureRises[i] - tapAt) % beat;
+      if (off > beat / 2)
+        off = beat - off;
+      check(off <= slop + drift * double(measureRises[i] - tapAt),
+        "%s: measure %d is %.1fms off the taps", name, i,
+        double(off) / ticksPerMs);
+      if (i == firstRise)
+        first = double(off) / ticksPerUs;
+    }
+    return first;
+  }
+
+  State fourFour() {
+    State state;
+    state.settings = { 2, 4, 4, 3, 1, 4 };  // two measures of 4/4, triplets
+    state.memoryIndex = 0;
+    state.syncMode = syncFixed;
+    state.userBpm = 120;
+    return state;
+  }
+
+  void testAlign() {
+    tapAlong("align", fourFour());
+
+    State tuplet = fourFour();
+    tuplet.outputModeB = otuputTuplet;
+    tapAlong("align tuplet B", tuplet);
+
+    State factored = fourFour();
+    factored.outputFactorB = 3;
+    tapAlong("align B x3", factored);
+
+    State swung = fourFour();
+    swung.swing = 66;
+    tapAlong("align swung", swung);
+
+    // sequences that aren't a whole number of quarter notes
+    State fiveEight = fourFour();
+    fiveEight.settings = { 1, 5, 8, 3, 1, 4 };
+    State sevenSixteen = fourFour();
+    sevenSixteen.settings = { 3, 7, 16, 3, 1, 4 };
+    for (int i = 0; i < 8; ++i) {
+      uint64_t phase = ticksPerSecond / 3 + i * ticksPerSecond / 7;
+      tapAlong("align 5/8", fiveEight, 600000, phase);
+      tapAlong("align 3 x 7/16", sevenSixteen, 600000, phase);
+    }
+  }
+
+  // Taps on the beats the outputs are already playing, so nothing should
+  // move: The measures must stay on the beats they were on.
+  void keepBar(const char* name, const State& state) {
+    measureRiseCount = 0;
+    simOnEdge(recordEdge);
+
+    initializeTimers();
+    initializeClock();
+    setBpm(state.userBpm);
+    setSync(state.syncMode);
+    resetTiming(state);
+    simAdvance(3 * ticksPerSecond);
+
+    const uint64_t ticksPerUs = ticksPerSecond / 1000000;
+    const uint32_t interval = 60000000 / state.userBpm;
+    uint64_t quarter = interval * ticksPerUs;
+    uint64_t measure = quarter * 4 * state.settings.beatsPerMeasure
+      / state.settings.beatUnit;
+    uint64_t bar = measureRises[measureRiseCount - 1];
+
+    TapTempo taps;
+    uint64_t tapAt = bar + measure;
+    for (int i = 0; i < 4; ++i, tapAt += quarter) {
+      simAdvance(tapAt + ticksPerSecond * 7 / 100 - simNow());
+      taps.tap((uint32_t)(tapAt / ticksPerUs));
+      if (taps.ready()) {
+        setBeatPeriod(taps.interval());
+        alignBeat(micros() - taps.lastTap());
+      }
+    }
+
+    int firstRise = measureRiseCount;
+    simAdvance(4 * ticksPerSecond);
+
+    uint64_t slop = quarter / 480;
+    for (int i = firstRise; i < measureRiseCount; ++i) {
+      uint64_t off = (measureRises[i] - bar) % measure;
+      if (off > measure / 2)
+        off = measure - off;
+      check(off <= slop, "%s: measure %d moved %.1fms", name, i,
+        double(off) / ticksPerMs);
+    }
+  }
+
+  void testKeepBar() {
+    keepBar("keep bar", fourFour());
+
+    State fiveEight = fourFour();
+    fiveEight.settings = { 1, 5, 8, 3, 1, 4 };
+    keepBar("keep bar 5/8", fiveEight);
+
+    State sevenSixteen = fourFour();
+    sevenSixteen.settings = { 3, 7, 16, 3, 1, 4 };
+    keepBar("keep bar 3 x 7/16", sevenSixteen);
+  }
+
+  void benchmarkLatency() {
+    // how far the first measure after tapping lands from the taps, at
+    // various tempos, and at various phases to the outputs before tapping
+    printf("tap to output latency:\n");
+    const uint32_t intervals[] = { 1000000, 600000, 500000, 333333, 250000 };
+    for (auto interval : intervals) {
+      double mean = 0, worst = 0;
+      const int phases = 16;
+      for (int i = 0; i < phases; ++i) {
+        uint64_t phase = ticksPerSecond / 3 + i * ticksPerSecond / 17;
+        double latency = tapAlong("latency", fourFour(), interval, phase);
+        mean += latency / phases;
+        worst = max(worst, latency);
+      }
+      printf("  %5.1f bpm: mean %5.1fus, max %5.1fus\n",
+        60e6 / interval, mean, worst);
+    }
+  }
+}
+
+int main() {
+  testEstimate();
+  testAlign();
+  testKeepBar();
+  benchmarkLatency();
+
+  return checkResult();
+}
@@ -0,0 +1,422 @@
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "host.h"
+#include "state.h"
+#include "timing.h"
+
+/*
+  Tests of the periods computed for the outputs: that each output mode and
+  factor the UI offers, when outputsFit() allows it, divides its source
+  exactly and fits the timers, and that those it doesn't are rejected.
+
+  Also the routing: that each output plays the source period of the mode it
+  is routed to, whatever the others are routed to.
+
+  And that no setting, offered or beyond what the UI offers, has a period
+  truncated by the timers: the settings the UI offers need no shift of the
+  quantum, and the rest either shift exactly or are rejected.
+*/
+
+namespace {
+  // the options offered in layout.cpp, ui_music.cpp and ui_setup.cpp
+  const uint8_t numberMeasures[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  const uint8_t beatUnits[] = { 2, 4, 8, 16 };
+  const uint8_t tupletCounts[] = { 2, 3, 4, 5, 6, 7, 8, 9 };
+  const uint8_t tupletTimes[] = { 2, 3, 4, 6, 8 };
+  const uint8_t tupletUnits[] = { 16, 8, 4 };
+  const uint8_t swings[] = { swingNone, 54, 58, 62, 66, 71, swingMax };
+
+  const OutputMode modesM[] =
+    { outputMeasure, outputSequence, outputBeat, otuputTuplet,
+      outputFixed4, outputFixed8, outputFixed16, outputFixed32 };
+  const OutputMode modesB[] =
+    { outputBeat, otuputTuplet,
+      outputFixed4, outputFixed8, outputFixed16, outputFixed32 };
+  const OutputMode modesT[] =
+    { otuputTuplet, outputSequence, outputMeasure, outputBeat,
+      outputFixed4, outputFixed8, outputFixed16, outputFixed32 };
+  const OutputFactor factors[] =
+    { -8, -6, -4, -3, -2, outputFactorNone, 2, 3, 4, 6, 8 };
+
+  State baseState() {
+    State state;
+    state.settings = { 2, 4, 4, 3, 2, 4 };
+    state.memoryIndex = 0;
+    state.syncMode = syncFixed;
+    state.userBpm = 120;
+    return state;
+  }
+
+  // the timers, as in timing.cpp
+  const q_t maxTCCPeriod = 1ul << 24;
+  const q_t maxTCPeriod = 1ul << 16;
+
+  bool truncated(const Timing& t, uint8_t shift) {
+    // every period, and each half of a swung pair, must be a whole number
+    // of counts, and fit its counter, and every measure have its place in
+    // the measure table
+    if (t.sequence > maxNumberMeasures * t.measure)
+      return true;
+    q_t mask = (q_t(1) << shift) - 1;
+    if (((t.sequence | t.measure
+          | t.periodS | t.periodM | t.periodB | t.periodT
+          | t.cycleB | t.cycleT | t.swungB | t.swungT) & mask) != 0)
+      return true;
+    return (t.periodS >> shift) > maxTCCPeriod
+      || (t.periodM >> shift) > maxTCCPeriod
+      || (max(t.periodB, t.swungB) >> shift) > maxTCPeriod
+      || (max(t.periodT, t.swungT) >> shift) > maxTCCPeriod;
+  }
+
+  bool exact(OutputFactor f, q_t source, q_t period) {
+    if (f > 1)
+      return period * q_t(f) == source;
+    if (f < -1)
+      return period == source * q_t(-f);
+    return period == source;
+  }
+
+  int fitting = 0;
+  int rejected = 0;
+
+  void checkOutputs(const State& state) {
+    if (!outputsFit(state)) {
+      ++rejected;
+      return;
+    }
+    ++fitting;
+
+    State unfactored = state;
+    unfactored.outputFactorM = outputFactorNone;
+    unfactored.outputFactorB = outputFactorNone;
+    unfactored.outputFactorT = outputFactorNone;
+
+    Timing t, sources;
+    computePeriods(state, t);
+    computePeriods(unfactored, sources);
+
+    const Settings& u = state.settings;
+    if (!exact(state.outputFactorM, sources.periodM, t.periodM)
+        || !exact(state.outputFactorB, sources.periodB, t.periodB)
+        || !exact(state.outputFactorT, sources.periodT, t.periodT))
+      check(false, "%d x %d/%d, %d:%d/%d, M %x x%d, B %x x%d, T %x x%d: "
+        "inexact", u.numberMeasures, u.beatsPerMeasure, u.beatUnit,
+        u.tupletCount, u.tupletTime, u.tupletUnit,
+        state.outputModeM, state.outputFactorM,
+        state.outputModeB, state.outputFactorB,
+        state.outputModeT, state.outputFactorT);
+
+    uint32_t writes = hostCriticalWrites;
+    if (truncated(t, quantumShift(t)) || hostCriticalWrites != writes)
+      check(false, "%d x %d/%d, %d:%d/%d, M %x x%d, T %x x%d: "
+        "doesn't fit", u.numberMeasures, u.beatsPerMeasure, u.beatUnit,
+        u.tupletCount, u.tupletTime, u.tupletUnit,
+        state.outputModeM, state.outputFactorM,
+        state.outputModeT, state.outputFactorT);
+  }
+
+  void forEachSetting(void (*test)(const State&)) {
+    State state = baseState();
+    Settings& u = state.settings;
+    for (auto m : numberMeasures) {
+      u.numberMeasures = m;
+      for (uint8_t b = 1; b <= 16; ++b) {
+        u.beatsPerMeasure = b;
+        for (auto bu : beatUnits) {
+          u.beatUnit = bu;
+          for (auto tc : tupletCounts) {
+            u.tupletCount = tc;
+            for (auto tt : tupletTimes) {
+              u.tupletTime = tt;
+              for (auto tu : tupletUnits) {
+                u.tupletUnit = tu;
+                test(state);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  void eachOutput(const State& base) {
+    // one output at a time, as exactness is per output
+    for (auto f : factors) {
+      State state = base;
+      state.outputFactorM = f;
+      for (auto m : modesM) { state.outputModeM = m; checkOutputs(state); }
+
+      state = base;
+      state.outputFactorB = f;
+      for (auto m : modesB) { state.outputModeB = m; checkOutputs(state); }
+
+      state = base;
+      state.outputFactorT = f;
+      for (auto m : modesT) { state.outputModeT = m; checkOutputs(state); }
+    }
+  }
+
+  q_t expectedPeriod(const Settings& u, OutputMode m) {
+    // worked out from the note values, rather than as timing.cpp does
+    q_t whole = 4 * Q_PER_B;
+    q_t measure = u.beatsPerMeasure * whole / u.beatUnit;
+    switch (m) {
+      case outputSequence:  return u.numberMeasures * measure;
+      case outputMeasure:   return measure;
+      case outputBeat:      return whole / u.tupletUnit;
+      case otuputTuplet:
+        return u.tupletTime * whole / (u.tupletUnit * u.tupletCount);
+      case outputFixed4:    return whole / 4;
+      case outputFixed8:    return whole / 8;
+      case outputFixed16:   return whole / 16;
+      case outputFixed32:   return whole / 32;
+      default:              return 0;
+    }
+  }
+
+  int routings = 0;
+
+  void checkRouting(const State& state) {
+    ++routings;
+    Timing t;
+    computePeriods(state, t);
+
+    const Settings& u = state.settings;
+    q_t sequence = expectedPeriod(u, outputSequence);
+    q_t wantM = expectedPeriod(u, state.outputModeM);
+    q_t wantB = expectedPeriod(u, state.outputModeB);
+    q_t wantT = expectedPeriod(u, state.outputModeT);
+    if (t.periodS != sequence || t.periodM != wantM
+        || t.periodB != wantB || t.periodT != wantT)
+      check(false, "routing: %d x %d/%d, %d:%d/%d, M %x, B %x, T %x: "
+        "periods %u %u %u %u, not %u %u %u %u",
+        u.numberMeasures, u.beatsPerMeasure, u.beatUnit,
+        u.tupletCount, u.tupletTime, u.tupletUnit,
+        state.outputModeM, state.outputModeB, state.outputModeT,
+        t.periodS, t.periodM, t.periodB, t.periodT,
+        sequence, wantM, wantB, wantT);
+  }
+
+  void eachRouting(const State& base) {
+    // one output at a time, the others as they are by default
+    State state = base;
+    for (auto m : modesM) { state.outputModeM = m; checkRouting(state); }
+    state = base;
+    for (auto m : modesB) { state.outputModeB = m; checkRouting(state); }
+    state = base;
+    for (auto m : modesT) { state.outputModeT = m; checkRouting(state); }
+  }
+
+  void allRoutings(State state) {
+    // every output routed every way at once
+    for (auto mm : modesM) {
+      state.outputModeM = mm;
+      for (auto mb : modesB) {
+        state.outputModeB = mb;
+        for (auto mt : modesT) {
+          state.outputModeT = mt;
+          checkRouting(state);
+        }
+      }
+    }
+  }
+
+  void testRouting() {
+    routings = 0;
+    forEachSetting(eachRouting);
+
+    State state = baseState();
+    allRoutings(state);
+    state.settings = { 8, 16, 2, 9, 2, 4 };     // the longest sequence
+    allRoutings(state);
+    state.settings = { 1, 1, 16, 7, 3, 16 };    // the shortest
+    allRoutings(state);
+    state.settings = { 3, 5, 8, 5, 4, 8 };
+    allRoutings(state);
+
+    printf("routing: %d routings\n", routings);
+  }
+
+  void testEachOutput() {
+    fitting = rejected = 0;
+    forEachSetting(eachOutput);
+    printf("each output: %d fit, %d rejected\n", fitting, rejected);
+    check(rejected > 0, "each output: nothing rejected");
+  }
+
+  void testLongest() {
+    // the longest sequence, where slowed outputs need the quantum shifted,
+    // with M and T together as both use the 24 bit TCCs
+    fitting = rejected = 0;
+    State state = baseState();
+    state.settings = { 8, 16, 2, 3, 2, 4 };
+    for (auto tc : tupletCounts) {
+      state.settings.tupletCount = tc;
+      for (auto tu : tupletUnits) {
+        state.settings.tupletUnit = tu;
+        for (auto mm : modesM) {
+          state.outputModeM = mm;
+          for (auto fm : factors) {
+            state.outputFactorM = fm;
+            for (auto mt : modesT) {
+              state.outputModeT = mt;
+              for (auto ft : factors) {
+                state.outputFactorT = ft;
+                checkOutputs(state);
+              }
+            }
+          }
+        }
+      }
+    }
+    printf("longest: %d fit, %d rejected\n", fitting, rejected);
+  }
+
+  void testOffered() {
+    // every setting the UI offers, with each swing
+    int combinations = 0;
+    uint32_t writes = hostCriticalWrites;
+    for (auto sw : swings) {
+      State state = baseState();
+      state.swing = sw;
+      Settings& u = state.settings;
+      for (auto m : numberMeasures) {
+        u.numberMeasures = m;
+        for (uint8_t b = 1; b <= 16; ++b) {
+          u.beatsPerMeasure = b;
+          for (auto bu : beatUnits) {
+            u.beatUnit = bu;
+            for (auto tc : tupletCounts) {
+              u.tupletCount = tc;
+              for (auto tt : tupletTimes) {
+                u.tupletTime = tt;
+                for (auto tu : tupletUnits) {
+                  u.tupletUnit = tu;
+                  ++combinations;
+
+                  Timing t;
+                  computePeriods(state, t);
+                  uint8_t shift = quantumShift(t);
+                  if (shift != 0 || truncated(t, 0))
+                    check(false, "offered: %d x %d/%d, %d:%d/%d, swing %d: "
+                      "shift %d", m, b, bu, tc, tt, tu, sw, shift);
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+    printf("offered: %d combinations\n", combinations);
+    check(hostCriticalWrites == writes, "offered: reported critical");
+  }
+
+  void testBeyond() {
+    // longer sequences, and whole note beats and tuplets, as the UI may
+    // offer one day: more measures than the measure table holds must be
+    // rejected
+    const uint8_t wideUnits[] = { 1, 2, 4, 8, 16 };
+    int unshifted = 0;
+    int shifted = 0;
+    int rejected = 0;
+    uint32_t writes = hostCriticalWrites;
+    State state = baseState();
+    Settings& u = state.settings;
+    for (uint8_t m = 1; m <= 32; ++m) {
+      u.numberMeasures = m;
+      for (uint8_t b = 1; b <= 16; ++b) {
+        u.beatsPerMeasure = b;
+        for (auto bu : wideUnits) {
+          u.beatUnit = bu;
+          for (auto tc : tupletCounts) {
+            u.tupletCount = tc;
+            for (auto tt : tupletTimes) {
+              u.tupletTime = tt;
+              for (auto tu : wideUnits) {
+                u.tupletUnit = tu;
+                if (!outputsFit(state)) {
+                  ++rejected;
+                  continue;
+                }
+                if (m > maxNumberMeasures) {
+                  check(false, "beyond: %d measures fit", m);
+                  continue;
+                }
+
+                Timing t;
+                computePeriods(state, t);
+                uint8_t shift = quantumShift(t);
+                ++(shift ? shifted : unshifted);
+                if (truncated(t, shift))
+                  check(false, "beyond: %d x %d/%d, %d:%d/%d: truncated "
+                    "at shift %d", m, b, bu, tc, tt, tu, shift);
+              }
+            }
+          }
+        }
+      }
+    }
+    printf("beyond: %d unshifted, %d shifted, %d rejected\n",
+      unshifted, shifted, rejected);
+    check(hostCriticalWrites == writes, "beyond: reported critical");
+  }
+
+  void testRejected() {
+    State tuplet9 = baseState();
+    tuplet9.settings.tupletCount = 9;
+    tuplet9.settings.tupletTime = 2;
+    tuplet9.outputModeB = otuputTuplet;
+    tuplet9.outputFactorB = 3;
+    check(!outputsFit(tuplet9), "rejected: B as a 9-tuplet x3");
+
+    State fixed32 = baseState();
+    fixed32.outputModeT = outputFixed32;
+    fixed32.outputFactorT = 8;
+    check(!outputsFit(fixed32), "rejected: T as 32nds x8");
+
+    State longest = baseState();
+    longest.settings = { 8, 16, 2, 9, 2, 4 };
+    longest.outputModeM = outputSequence;
+    longest.outputFactorM = -8;
+    check(outputsFit(longest), "rejected: M as the longest sequence /8");
+    Timing t;
+    computePeriods(longest, t);
+    check(quantumShift(t) == 1, "rejected: the longest sequence /8 has "
+      "shift %d", quantumShift(t));
+    longest.outputFactorT = 3;
+    check(!outputsFit(longest), "rejected: and T as a 9-tuplet x3");
+
+    fitOutputs(longest);
+    check(longest.outputFactorT == outputFactorNone
+        && longest.outputFactorM == -8,
+      "rejected: fitOutputs() left T x%d, M x%d",
+      longest.outputFactorT, longest.outputFactorM);
+
+    // swung pairs must fit the sequence whole
+    State odd = baseState();
+    odd.settings = { 1, 3, 4, 3, 1, 4 };
+    odd.swing = 66;
+    check(!outputsFit(odd), "rejected: swing over one measure of 3/4");
+    odd.settings.numberMeasures = 2;
+    check(outputsFit(odd), "rejected: swing over two measures of 3/4");
+    fitOutputs(odd);
+    check(odd.swing == 66, "rejected: fitOutputs() dropped swing");
+    odd.settings.numberMeasures = 1;
+    fitOutputs(odd);
+    check(odd.swing == swingNone, "rejected: fitOutputs() left swing %d",
+      odd.swing);
+  }
+}
+
+int main() {
+  testRouting();
+  testEachOutput();
+  testLongest();
+  testOffered();
+  testBeyond();
+  testRejected();
+
+  return checkResult();
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+
+#include "clock.h"
+#include "host.h"
+#include "replay.h"
+
+/*
+  Tests of the watchdog that decides the master has stopped: a tight clock
+  must be declared stopped within about 1.2 intervals of its last edge, and
+  a sloppy one must get the headroom it needs not to be declared stopped
+  while running, but no more than 3 intervals.
+
+  Even a perfect clock measures a little jitter, as the outputs bend their
+  rate to correct the phase, hence a little over 1.2.
+
+  On starting, the rate isn't known, so the watchdog must wait for a master
+  as slow as the range allows.
+*/
+
+namespace {
+  SyncMode syncFor(int perBeat) {
+    switch (perBeat) {
+      case 1:   return sync1ppqn;
+      case 4:   return sync4ppqn;
+      case 48:  return sync48ppqn;
+      default:  return sync24ppqn;
+    }
+  }
+
+  void stopping(int perBeat, double bpm, double jitter,
+      double minIntervals, double maxIntervals)
+  {
+    ClockTrace clock(perBeat);
+    double intervalMs = 60000.0 / bpm / perBeat;
+    clock.steady(bpm, 16, jitter * intervalMs * 1000);
+
+    ReplayStats stats;
+    replayBegin(syncFor(perBeat), (bpm_t)bpm);
+    replayClock(clock, stats);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%d ppqn, %g bpm, jitter %g%%",
+      perBeat, bpm, jitter * 100);
+    printStats(name, stats);
+
+    double stopIntervals = stats.stopMs / intervalMs;
+    printf("  stopped %.2f intervals after the last edge\n", stopIntervals);
+
+    check(stats.perplexes == 0, "%s: went perplexed", name);
+    check(stats.losts == 0, "%s: lost the clock while running", name);
+    check(stats.stopMs >= 0, "%s: never stopped", name);
+    check(minIntervals <= stopIntervals && stopIntervals <= maxIntervals,
+      "%s: stopped after %.2f intervals", name, stopIntervals);
+  }
+
+  void starting(int perBeat, double bpm, bpm_t preset) {
+    ClockTrace clock(perBeat);
+    clock.steady(bpm, 8);
+
+    ReplayStats stats;
+    replayBegin(syncFor(perBeat), preset);
+    replayClock(clock, stats);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%d ppqn, %g bpm, from %d",
+      perBeat, bpm, preset);
+    printStats(name, stats);
+
+    check(stats.losts == 0, "%s: lost the clock while starting", name);
+  }
+}
+
+int main() {
+  // tight
+  stopping(24, 120, 0, 1.15, 1.35);
+  stopping(48, 75, 0, 1.15, 1.35);
+  stopping(4, 174, 0, 1.15, 1.35);
+  stopping(1, 90, 0, 1.15, 1.35);
+
+  // sloppy, each edge is up to this fraction of an interval early or late,
+  // so the intervals vary twice that
+  stopping(24, 120, 0.1, 1.4, 3.05);
+  stopping(24, 120, 0.2, 1.6, 3.05);
+  stopping(4, 120, 0.25, 1.6, 3.05);
+
+  // starting far slower than the preset
+  starting(1, 60, 300);
+  starting(4, 30, 300);
+  starting(24, 30, 300);
+
+  return checkResult();
+}
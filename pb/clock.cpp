@@ -3,9 +3,11 @@
 #include <Arduino.h>
 
 #include "config.h"
+#include "events.h"
+#include "reciprocal.h"
 #include "timer_hw.h"
 
-#define DEBUG_ISR 0
+#define RECORD_CAPTURES 0
 
 // In this section of code, be very careful about numeric types
 #pragma GCC diagnostic push
@@ -15,6 +17,15 @@ namespace {
 
   Timing activeTiming;
 
+  Timing snapshotTiming() {
+    // the measure interrupt rewrites activeTiming when staged periods are
+    // applied, so outside of interrupts, copy it with them held off
+    noInterrupts();
+    Timing timing = activeTiming;
+    interrupts();
+    return timing;
+  }
+
   // the divisor currently set on the timer, may jitter to correct phase
   divisor_t activeDivisor = 0;  // so it will be set the first time
 
@@ -47,6 +58,17 @@ namespace {
   ClockMode   clockMode = modeFirsttime;
   ClockState  clockState = clockPaused;
 
+  void writePreZeros() {
+    // set just "before" zero so first quantum after pause will trigger
+    // all the outputs
+    Offsets preZeros;
+    preZeros.countS = activeTiming.periodS - 1;
+    preZeros.countM = activeTiming.periodM - 1;
+    preZeros.countB = activeTiming.cycleB - 1;
+    preZeros.countT = activeTiming.cycleT - 1;
+
+    writeCounts(preZeros);
+  }
 
   void setState(ClockState cs) {
     if (clockState == cs)
@@ -67,16 +89,7 @@ namespace {
     else {
       stopQuantumEvents();
       forceTriggersOff(true);
-
-      // set just "before" zero so first quantum after pause will trigger
-      // all the outputs
-      Offsets preZeros;
-      preZeros.countS = activeTiming.periodS - 1;
-      preZeros.countM = activeTiming.periodM - 1;
-      preZeros.countB = activeTiming.periodB - 1;
-      preZeros.countT = activeTiming.periodT - 1;
-
-      writeCounts(preZeros);
+      writePreZeros();
     }
   }
 
@@ -111,12 +124,12 @@ namespace {
   divisor_t runningDivisorMin = 907;    // 315 bpm
   divisor_t runningDivisorMax = 10582;  // 27 bpm
 
-  void setBpmRange(float low, float high) {
-    divisorMin = divisorFromBpm(high);
-    divisorMax = divisorFromBpm(low);
+  void setBpmRange(bpm_t low, bpm_t high) {
+    divisorMin = divisorFromBpm100(high * 100u);
+    divisorMax = divisorFromBpm100(low * 100u);
 
-    runningDivisorMin = divisorFromBpm(high * 1.05f);
-    runningDivisorMax = divisorFromBpm(low * 0.95f);
+    runningDivisorMin = divisorFromBpm100(high * 105u);
+    runningDivisorMax = divisorFromBpm100(low * 95u);
   }
 
   /** EXTERNAL CLOCK FREQ ESTIMATOR & PHASE LOCKED LOOP **/
@@ -126,10 +139,21 @@ namespace {
     return (x + q / 2) / q;
   }
 
+  constexpr Reciprocal reciprocalQPerB(Q_PER_B);
+
+  // x * Q_PER_B / (Q_PER_B - phase), for |phase| < Q_PER_B / 2
+  //
+  // With 24 or 48 clocks per beat, this is within 2 of the exact result.
+  // With 1 clock per beat, the phase correction may be up to 1/8th off.
+  inline uint32_t phaseCorrect(uint32_t x, q_t phase) {
+    return reciprocalQPerB.scaleByComplement(x, (int32_t)phase);
+  }
+
 
 
   // These are used to communicate changes in the clocking to the interrupt
   // service routine.
+  const int clocksPerBeatAuto = -1;
   volatile int externalClocksPerBeat = 0;
   volatile bool pendingExternalClocksPerBeatChange = false;
 
@@ -140,34 +164,198 @@ namespace {
   q_t       captureClkQ = 0;
   q_t       captureClkQHalf = 0;
   q_t       captureClkQWait = 0;
+  q_t       captureClkQMinMargin = 0;
   q_t       captureSequencePeriod = 0;
   const int captureBufferBeats = 2;
   const int captureBufferSize = captureBufferBeats * 48;
-  divisor_t captureBuffer[captureBufferSize];
+  uint32_t  captureBuffer[captureBufferSize];   // 8 bits of fraction
   divisor_t captureHistory[captureBufferSize];
   int       captureBufferSpan;
   int       captureNext = 0;
   uint32_t  captureSum = 0;
   int       captureCount = 0;
 
+  Reciprocal captureClkQReciprocal(1);
+
+  // For dividing captureSum by captureCount. This is within one of exact,
+  // that is within 1/256th of a divisor step. The sum is at most 96
+  // divisors, with 8 bits of fraction, so less than 2^30 even at the slow
+  // end of the extended range.
+  CountReciprocals<captureBufferSize> captureCountReciprocals;
+
+  inline uint32_t captureAverage8() {
+    return captureCountReciprocals.roundingDivide(captureSum, captureCount);
+  }
+
   bool captureLastSampleValid = false;
   q_t captureLastSample = 0;
 
   q_t captureWatchdogStartCount = 0;
 
+  // When the external clock drops out, the clock can coast at the last
+  // filtered rate for configuration.flywheelBeats, before pausing. This
+  // counts down the beats left, and is zero when not coasting.
+  int captureFlywheel = 0;
+
+  // The filtered divisor, with 8 bits of fraction, for coasting.
+  uint32_t  captureFilt8 = 0;
+
+  // The quantum timer only takes a whole divisor, and near 300 bpm one step
+  // is 0.1% of the tempo. So the fractional divisor is dithered: each time
+  // it is set, the fraction is accumulated, and the divisor is bumped up by
+  // one when the accumulator carries. Since the divisor is set once per
+  // external clock, the average over a few clocks is the fractional divisor,
+  // and the phase doesn't drift while locked.
+  uint32_t  captureDither = 0;
+
+  inline divisor_t ditherDivisor(uint32_t d8) {
+    uint32_t sum = captureDither + (d8 & 0xff);
+    captureDither = sum & 0xff;
+    return (divisor_t)((d8 >> 8) + (sum >> 8));
+  }
+
+  void setCaptureRate(int perBeat) {
+    capturesPerBeat = perBeat;
+    captureClkQ = perBeat ? Q_PER_B / perBeat : 0;
+    captureClkQHalf = captureClkQ / 2;
+    captureClkQWait = captureClkQ * 2;
+    captureClkQMinMargin = captureClkQ / 5;
+    captureClkQReciprocal = Reciprocal(perBeat ? captureClkQ : 1);
+    captureBufferSpan = captureBufferBeats * perBeat;
+    captureNext = 0;
+    captureSum = 0;
+    captureCount = 0;
+    captureLastSampleValid = false;
+  }
+
+
+  /** CLOCK RATE DETECTION **/
+
+  // With syncAuto, the number of clocks per beat is inferred from the
+  // incoming clock, once it has been steady for a few intervals. A steady
+  // clock can't, by itself, tell 4 clocks per beat at 120 bpm from 8 at
+  // 60 bpm. So of the supported rates that give a tempo in the selected BPM
+  // range, the one nearest the current tempo, by ratio, is chosen. But 24
+  // clocks per beat, as DIN sync and MIDI use, is far more common than 48,
+  // so 48 has to be half again nearer to be chosen over it.
+  //
+  // Which means a clock is only taken at its real rate when its tempo is
+  // near enough the current one: within 0.71 to 1.41 times it at 1, 2, 4,
+  // or 8 clocks per beat, 0.58 to 1.73 times at 24, and above 0.87 times at
+  // 48. From 120 bpm, 48 clocks per beat at 75 bpm are taken as 24 at 150.
+  // The tempo shown tells, and setting the tempo near the master's before
+  // starting it gets it right. See syncAuto in state.h.
+  //
+  // The edges timed while detecting are counted, so the outputs start as
+  // if they had started on the first of them. That is the master's start,
+  // when it starts with detection, but after going perplexed it is just the
+  // first edge seen, and the outputs can be out of step with the master's
+  // beats until it resets them.
+  //
+  // Detection happens when there is no rate yet, or the clock becomes
+  // perplexed. Pausing keeps the detected rate, so that restarting the
+  // external clock gets the fast acquire.
+
+  const int detectIntervals = 4;
+  const int detectRates[] = { 1, 2, 4, 8, 24, 48 };
+  const int detectRateCount = sizeof(detectRates) / sizeof(detectRates[0]);
+  constexpr Reciprocal detectClkQReciprocals[detectRateCount] = {
+    Reciprocal(Q_PER_B / 1), Reciprocal(Q_PER_B / 2), Reciprocal(Q_PER_B / 4),
+    Reciprocal(Q_PER_B / 8), Reciprocal(Q_PER_B / 24), Reciprocal(Q_PER_B / 48)
+  };
+
+  bool      captureAuto = false;
+  bool      captureDetecting = false;
+  int       detectCount = 0;
+  uint32_t  detectTicks[detectIntervals];   // CPU ticks per clock
+  q_t       detectAt = 0;     // the edges since the first, as if at 48
+                              // clocks per beat, within the sequence
+  q_t       captureStartAt = 0;             // where the outputs start
+
+  inline void startDetecting() {
+    captureDetecting = captureAuto;
+    detectCount = 0;
+  }
+
+  // Where the master is, in the sequence, after the edges timed so far.
+  void positionDetected(int perBeat) {
+    // all the rates divide 48, and detectAt * 48 is under 2^27
+    captureStartAt = (detectAt * (q_t)(48 / perBeat)) % activeTiming.sequence;
+  }
+
+  int detectClockRate(q_t watchdogSample) {
+    if (detectCount > 0) {
+      q_t qdiff = watchdogSample - captureWatchdogStartCount;
+      detectTicks[(detectCount - 1) % detectIntervals] =
+        (uint32_t)activeDivisor * qdiff;
+    }
+    captureWatchdogStartCount = resetWatchdog(0xffff);
+      // the slowest plausible clock may be a long time coming
+
+    if (detectCount == 0)
+      detectAt = 0;
+    else {
+      detectAt += Q_PER_B / 48;
+      if (detectAt >= activeTiming.sequence)
+        detectAt -= activeTiming.sequence;
+    }
+    detectCount += 1;
+    if (detectCount <= detectIntervals)
+      return 0;
+    if (detectCount > 2 * detectIntervals)
+      detectCount -= detectIntervals;   // keeps the ring index in step
+
+    uint32_t lo = detectTicks[0];
+    uint32_t hi = detectTicks[0];
+    uint64_t sum = 0;
+    for (int i = 0; i < detectIntervals; ++i) {
+      lo = min(lo, detectTicks[i]);
+      hi = max(hi, detectTicks[i]);
+      sum += detectTicks[i];
+    }
+    if (hi - lo > hi / 8)
+      return 0;   // not steady, yet
+
+    uint32_t ticksPerClock = (uint32_t)(sum / detectIntervals);
+      // a shift, and less than 2^31, as each interval is under 0xffff Q
+    uint32_t ref = targetDivisor ? targetDivisor : divisorMax;
+    int best = 0;
+    uint32_t bestFar = 0;     // the ratio of the best to ref
+    uint32_t bestNear = 1;    // is bestFar / bestNear, to save dividing
+
+    for (int i = 0; i < detectRateCount; ++i) {
+      uint32_t d = detectClkQReciprocals[i].roundingDivide(ticksPerClock);
+      if (!(divisorMin <= d && d <= divisorMax))
+        continue;
+
+      uint32_t far = max(d, ref);
+      uint32_t near = min(d, ref);
+      if (detectRates[i] == 48) {
+        far *= 3;
+        near *= 2;
+      }
+      if (best == 0 || (uint64_t)far * bestNear < (uint64_t)bestFar * near) {
+        best = detectRates[i];
+        bestFar = far;
+        bestNear = near;
+      }
+    }
+
+    return best;
+  }
+
   inline void processPending() {
     if (pendingExternalClocksPerBeatChange) {
       int perBeat = externalClocksPerBeat;
-      if (capturesPerBeat != perBeat) {
-        capturesPerBeat = perBeat;
-        captureClkQ = perBeat ? Q_PER_B / perBeat : 0;
-        captureClkQHalf = captureClkQ / 2;
-        captureClkQWait = captureClkQ * 2;  // TODO: 3? 2.5?
-        captureBufferSpan = captureBufferBeats * perBeat;
-        captureNext = 0;
-        captureSum = 0;
-        captureCount = 0;
-        captureLastSampleValid = false;
+      if (perBeat == clocksPerBeatAuto) {
+        captureAuto = true;
+        if (capturesPerBeat == 0 || !runningState(clockState))
+          startDetecting();
+      } else {
+        captureAuto = false;
+        captureDetecting = false;
+        if (capturesPerBeat != perBeat)
+          setCaptureRate(perBeat);
       }
       pendingExternalClocksPerBeatChange = false;
     }
@@ -180,55 +368,446 @@ namespace {
     // interrupts();
   }
 
+  /** TEMPO SLOPE **/
+
+  // When the external clock ramps its tempo, both the capture buffer average
+  // and the PLL lag behind, and the phase correction has to make up for it.
+  // So the slope of the tempo is tracked as well, with an alpha-beta filter:
+  // Each interval is predicted from the last estimate plus the slope, and the
+  // residual corrects both. The slope is then used to bring the estimates up
+  // to date.
+  //
+  // Like the PLL, this is fixed point, with 8 bits of fraction.
+
+  const bool trackTempoSlope = true;
+  const int slopeIntervalShift = 3;   // alpha: 1/8
+  const int slopeSlopeShift = 6;      // beta:  1/64
+
+  int32_t slopeInterval8 = 0;         // zero when not yet established
+  int32_t slope8 = 0;                 // change in divisor per clock
+
+  inline void slopeUpdate(uint32_t dNext8) {
+    if (!trackTempoSlope)
+      return;
+
+    if (slopeInterval8 == 0) {
+      slopeInterval8 = (int32_t)dNext8;
+      slope8 = 0;
+      return;
+    }
+
+    int32_t predicted = slopeInterval8 + slope8;
+    int32_t residual = (int32_t)dNext8 - predicted;
+    slopeInterval8 = predicted + (residual >> slopeIntervalShift);
+    slope8 += residual >> slopeSlopeShift;
+  }
+
+  // The average over the capture buffer is centered (n - 1) / 2 clocks in
+  // the past, and predicts the interval (n + 1) / 2 clocks on from that.
+  inline uint32_t slopeAdjustAverage(uint32_t average8, int n) {
+    return (uint32_t)((int32_t)average8 + slope8 * (n + 1) / 2);
+  }
+
+
+  /** PHASE LOCKED LOOP **/
+
+  // An alternative to averaging the capture buffer, selected with
+  // configuration.options.pllSync. This is a second order, proportional-
+  // integral loop: The frequency estimate is pulled toward each measured
+  // interval, and also integrates the phase error. The active divisor is
+  // then bent in proportion to the phase error.
+  //
+  // The phase error is expressed as the change in divisor that would absorb
+  // it over one beat, so that all the gains are relative to the existing
+  // averaging estimator, which is in effect a phase gain of one.
+  //
+  // Divisors here are fixed point, with 8 bits of fraction, as are the
+  // estimates it produces.
+
+  const int pllFrequencyShift = 3;    // frequency gain:   1/8
+  const int pllPhaseShift = 1;        // phase gain:       1/2
+  const int pllIntegralShift = 4;     // integral gain:    1/16
+
+  int32_t pllFreq8 = 0;               // zero when not yet established
+  bool    pllSelected = false;
+    // the option, as when the capture was last reset: When it changes, the
+    // estimator starts afresh, so the pll doesn't pick up where it was left
+
+  inline void pllUpdate(uint32_t dNext8, q_t phase,
+      uint32_t& dFilt8, uint32_t& dAdj8)
+  {
+    if (pllFreq8 == 0) {
+      pllFreq8 = (int32_t)dNext8;
+    } else {
+      pllFreq8 += slope8;
+      pllFreq8 += ((int32_t)dNext8 - pllFreq8) >> pllFrequencyShift;
+    }
+
+    int32_t d = pllFreq8 >> 8;
+    bool late = (int32_t)phase < 0;
+    uint32_t a = late ? -phase : phase;
+    int32_t error8 =
+      (int32_t)reciprocalQPerB.roundingDivide8((uint32_t)d * a);
+    if (late)
+      error8 = -error8;
+      // d * phase / Q_PER_B, with 8 bits of fraction: d * a < 2^28, even
+      // at the slow end of the extended range, with 1 clock per beat
+
+    pllFreq8 += error8 >> pllIntegralShift;
+    pllFreq8 = constrain(pllFreq8,
+      (int32_t)runningDivisorMin << 8, (int32_t)runningDivisorMax << 8);
+
+    // the estimate is of the interval just measured, the divisors are for
+    // the next one
+    int32_t next8 = pllFreq8 + slope8;
+    dFilt8 = (uint32_t)next8;
+    dAdj8 = (uint32_t)(next8 + (error8 >> pllPhaseShift));
+  }
+
+  // When starting, the first interval measured is taken as the rate for the
+  // whole capture buffer, rather than letting the buffer fill over
+  // captureBufferBeats. This way the outputs come out at tempo from the
+  // second clock.
+  const bool captureFastAcquire = true;
+
+  void primeCapture(uint32_t d8) {
+    for (int i = 0; i < captureBufferSpan; ++i) {
+      captureBuffer[i] = d8;
+      captureHistory[i] = (divisor_t)((d8 + 128) >> 8);
+    }
+    captureNext = 0;
+    captureSum = d8 * (uint32_t)captureBufferSpan;
+    captureCount = captureBufferSpan;
+  }
+
+  // Moves all the counts by the same amount, so they stay aligned, to put
+  // the edge sampled at sequenceSample at target.
+  //
+  // This only happens once or twice per start, so the divides in
+  // adjustOffsets() are tolerable here.
+  void moveCapture(q_t sequenceSample, q_t target) {
+    q_t sequence = activeTiming.sequence;
+    PauseQuantum pq;
+    Offsets counts;
+    readCounts(counts);
+      // the sequence may have moved on from the sample
+
+    q_t now = counts.countS + target + sequence - sequenceSample;
+    while (now >= sequence)
+      now -= sequence;      // at most twice
+    counts.countS = now;
+    adjustOffsets(activeTiming, counts);
+    writeCounts(counts);
+  }
+
+  // Until priming, the sequence ran at the old rate, so at this edge it is
+  // some way from where it should be: one clock on from the last edge.
+  // Returns where this edge now is.
+  q_t rephaseCapture(q_t sequenceSample) {
+    q_t sequence = activeTiming.sequence;
+    q_t target = captureLastSample + captureClkQ;
+    while (target >= sequence)
+      target -= sequence;   // a clock may be longer than a short sequence
+    if (target != sequenceSample)
+      moveCapture(sequenceSample, target);
+    return target;
+  }
+
+  // Once the rate is established, a single interval that is far from it is
+  // most likely a late, early, or doubled edge from a noisy connection. Up to
+  // captureOutlierLimit of these in a row are dropped, rather than let into
+  // the estimate. Any more, and the tempo really has changed.
+  const int captureOutlierLimit = 2;
+  int       captureOutliers = 0;
+
+  inline bool captureOutlier(uint32_t d) {
+    uint32_t established = targetDivisor;
+    uint32_t deviation = d > established ? d - established : established - d;
+    return deviation > established / 8;
+  }
+
+  // The watchdog waits for the next clock for the expected interval plus a
+  // margin of a fifth of an interval, and four times the measured jitter of
+  // the clock: So a tight clock is declared stopped a little over 1.2
+  // intervals after its last edge, and a sloppy one gets up to three. The
+  // jitter is a moving average of the absolute deviation of each interval,
+  // in Q with 4 bits of fraction. Being an average over a few clocks, it can
+  // dip well below the worst of a sloppy clock, hence the fifth on top.
+  //
+  // Until the jitter is measured, it is assumed large, for a wait of two
+  // intervals.
+  const int jitterShift = 3;          // moving average over about 8 clocks
+  q_t captureJitter16 = 0;
+
+  inline void resetJitter() {
+    captureJitter16 = (captureClkQ - captureClkQMinMargin) << 2;
+      // margin of one interval
+    captureClkQWait = captureClkQ * 2;
+  }
+
+  inline void updateJitter(q_t qdiff) {
+    q_t deviation16 =
+      (qdiff > captureClkQ ? qdiff - captureClkQ : captureClkQ - qdiff) << 4;
+    if (deviation16 > captureJitter16)
+      captureJitter16 += (deviation16 - captureJitter16) >> jitterShift;
+    else
+      captureJitter16 -= (captureJitter16 - deviation16) >> jitterShift;
+
+    q_t margin = captureClkQMinMargin + (captureJitter16 >> 2);
+      // four times the jitter
+    captureClkQWait = captureClkQ + min(margin, 2 * captureClkQ);
+  }
+
+  // When perplexed, the clock is out of range, and so the rate, and hence
+  // the watchdog timing, are unreliable. Wait for twice the offending
+  // interval, so that a clock that is steadily too slow doesn't also look
+  // stopped, but no less than normal, and no more than the watchdog can.
+  inline q_t perplexedWait(q_t qdiff) {
+    return constrain(2 * qdiff, captureClkQWait, (q_t)0xffff);
+  }
+
+  // On restart, the rate isn't established, and the master may be as slow
+  // as the range allows: Scale the wait by how much slower than the current
+  // tempo that is, rounded up to a power of two, as there is no divide.
+  inline q_t unpausedWait() {
+    q_t wait = captureClkQWait;
+    for (uint32_t d = activeDivisor; d < divisorMax && wait < 0xffff; d <<= 1)
+      wait <<= 1;
+    return min(wait, (q_t)0xffff);
+  }
+
   inline void zeroCapture() {
     captureNext = 0;
     captureSum = 0;
     captureCount = 0;
+    captureOutliers = 0;
+    pllFreq8 = 0;
+    pllSelected = configuration.options.pllSync;
+    slopeInterval8 = 0;
+    slope8 = 0;
+    resetJitter();
+  }
+
+
+  /** SYNC STATISTICS **/
+
+  // These are gathered by the interrupt service routines, so that changes
+  // to the estimator can be compared by numbers, rather than by ear. They
+  // are reported, and reset, by dumpClock().
+
+  const q_t lockPhaseTolerance = Q_PER_B / 480;
+    // phase error, in Q, within which the clock is considered locked
+
+  struct SyncStats {
+    uint32_t  edges;
+    uint32_t  unpauses;
+    uint32_t  perplexes;
+    uint32_t  outliers;
+    uint32_t  dropouts;
+
+    bool      locked;
+    q_t       unlockedQ;      // Q elapsed since unpausing, until locked
+    uint32_t  locks;
+    q_t       lastLockQ;
+    q_t       maxLockQ;
+
+    uint32_t  lockedEdges;
+    q_t       maxPhaseError;  // all these are only measured while locked
+    uint32_t  sumPhaseError;
+    divisor_t minDivisor;
+    divisor_t maxDivisor;
+  };
+
+  SyncStats syncStats;
+
+  void zeroSyncStats() {
+    syncStats = SyncStats();
+    syncStats.minDivisor = 0xffff;
+  }
+
+  inline void statsUnpause() {
+    syncStats.unpauses += 1;
+    syncStats.locked = false;
+    syncStats.unlockedQ = 0;
+  }
+
+  inline void statsPerplexed() {
+    syncStats.perplexes += 1;
+    syncStats.locked = false;
+  }
+
+  inline void statsDropout() {
+    syncStats.dropouts += 1;
+  }
+
+  inline void statsOutlier() {
+    syncStats.outliers += 1;
+  }
+
+  inline void statsEdge(q_t qdiff, q_t phase, divisor_t active) {
+    syncStats.edges += 1;
+
+    q_t phaseError = (phase > captureClkQHalf) ? -phase : phase;
+      // phase is signed, held in unsigned q_t: see isrClockCapture()
+
+    if (!syncStats.locked) {
+      syncStats.unlockedQ += qdiff;
+      if (phaseError > lockPhaseTolerance)
+        return;
+
+      syncStats.locked = true;
+      syncStats.locks += 1;
+      postEvent(eventClockLocked);
+      syncStats.lastLockQ = syncStats.unlockedQ;
+      syncStats.maxLockQ = max(syncStats.maxLockQ, syncStats.unlockedQ);
+    }
+
+    syncStats.lockedEdges += 1;
+    syncStats.maxPhaseError = max(syncStats.maxPhaseError, phaseError);
+    syncStats.sumPhaseError += phaseError;
+    syncStats.minDivisor = min(syncStats.minDivisor, active);
+    syncStats.maxDivisor = max(syncStats.maxDivisor, active);
   }
 
-#if DEBUG_ISR
-  uint32_t countWatchdogISR = 0;
-  uint32_t countClockISR = 0;
-  uint32_t countUnpausing = 0;
-  uint32_t countStillPerplexed = 0;
-  uint32_t countUnPerplexing = 0;
-  uint32_t countRunningChangePeriod = 0;
-  uint32_t countRunningInvalid = 0;
-  uint32_t countRunningPerplexed = 0;
-  uint32_t countRuningWell = 0;
-
-  void zeroDebugCounts() {
-    countWatchdogISR = 0;
-    countClockISR = 0;
-    countUnpausing = 0;
-    countStillPerplexed = 0;
-    countUnPerplexing = 0;
-    countRunningChangePeriod = 0;
-    countRunningInvalid = 0;
-    countRunningPerplexed = 0;
-    countRuningWell = 0;
-  }
-
-#define INC_COUNTER(c) (++c)
-#define DEC_COUNTER(c) (--c)
+
+#if RECORD_CAPTURES
+  // The raw samples given to isrClockCapture() are recorded, so that traces
+  // from real gear can be dumped and replayed against the estimator.
+
+  struct CaptureRecord {
+    q_t sequenceSample;
+    q_t watchdogSample;
+  };
+
+  const int captureRecordSize = 128;
+  CaptureRecord captureRecords[captureRecordSize];
+  int captureRecordNext = 0;
+  bool captureRecordWrapped = false;
+
+  inline void recordCapture(q_t sequenceSample, q_t watchdogSample) {
+    captureRecords[captureRecordNext].sequenceSample = sequenceSample;
+    captureRecords[captureRecordNext].watchdogSample = watchdogSample;
+    captureRecordNext += 1;
+    if (captureRecordNext >= captureRecordSize) {
+      captureRecordNext = 0;
+      captureRecordWrapped = true;
+    }
+  }
+
+  void dumpCaptureRecords() {
+    int i = captureRecordWrapped ? captureRecordNext : 0;
+    int n = captureRecordWrapped ? captureRecordSize : captureRecordNext;
+
+    Serial.printf("capture trace: %d samples, sequence period %d\n",
+      n, captureSequencePeriod);
+    for (; n > 0; --n) {
+      Serial.printf("trace %d %d\n",
+        captureRecords[i].sequenceSample, captureRecords[i].watchdogSample);
+      i = (i + 1) % captureRecordSize;
+    }
+
+    captureRecordNext = 0;
+    captureRecordWrapped = false;
+  }
 #else
-#define INC_COUNTER(c) (0)
-#define DEC_COUNTER(c) (0)
+  inline void recordCapture(q_t, q_t) { }
+  inline void dumpCaptureRecords() { }
 #endif
+
+  void pauseCapture() {
+    setState(clockPaused);
+    postEvent(eventClockLost);
+    detectCount = 0;
+    zeroCapture();
+    captureLastSampleValid = false;
+    captureFlywheel = 0;
+      // a pause while coasting, such as a MIDI stop, ends the coasting
+  }
+
+
+  /** MIDI SYNC **/
+
+  // MIDI clocks are fed to the capture hardware as software events, and so
+  // are handled just like edges on the clock input. These two are only
+  // touched from loop().
+
+  bool midiSync = false;      // sync mode is MIDI
+  bool midiRunning = true;    // between Start or Continue, and Stop
+    // starts true, so that clock from gear that never sends Start works
+
+  // But loop() can only parse clocks when it gets to them, which can be
+  // well after they arrived: a display redraw alone takes about 12ms. So
+  // midiClock() sets how late the clock is, in Q, and the capture interrupt
+  // moves the samples back to when it arrived.
+  volatile q_t midiLate = 0;
+  q_t midiLateBefore = 0;     // of the previous capture
+
+  q_t backdateCapture(q_t& sequenceSample, q_t& watchdogSample) {
+    q_t late = midiLate;
+    midiLate = 0;
+
+    q_t sequence = activeTiming.sequence;
+    late = min(late, sequence - 1);
+    sequenceSample = sequenceSample >= late
+      ? sequenceSample - late : sequenceSample + sequence - late;
+
+    // the watchdog was reset when the previous clock was captured, not when
+    // it arrived
+    watchdogSample = watchdogSample + midiLateBefore - late;
+    midiLateBefore = late;
+    return late;
+  }
+
+  // And the watchdog, reset when a clock is captured, has to wait for the
+  // next one for that much longer. This is midiSlackMicros, in Q.
+  const uint32_t midiSlackMicros = 20000;
+  volatile q_t midiSlack = 0;
+
+  q_t clockWait() {
+    return captureClkQWait + midiSlack;
+  }
 }
 
 void isrWatchdog() {
   if (clockMode == modeInternal)
     return;
-  if (clockState == clockPaused)
+  if (clockState == clockPaused) {
+    detectCount = 0;    // start over, if detecting
     return;
+  }
+
+  if (clockState == clockSyncRunning) {
+    if (captureFlywheel == 0) {
+      captureFlywheel = configuration.flywheelBeats;
+      if (captureFlywheel > 0) {
+        statsDropout();
+      }
+    } else {
+      captureFlywheel -= 1;
+    }
 
-  INC_COUNTER(countWatchdogISR);
+    if (captureFlywheel > 0) {
+      // coast at the filtered rate, with no phase correction
+      setDivisors(targetDivisor, ditherDivisor(captureFilt8));
+      resetWatchdog(Q_PER_B);
+      return;
+    }
+  }
 
   // pause, as an external clock hasn't been heard in too long
-  setState(clockPaused);
-  zeroCapture();
+  pauseCapture();
+}
+
+void isrReset() {
+  if (!runningState(clockState)) {
+    writePreZeros();
+      // so that the reset is the first quantum after pause
+    return;
+  }
+
   captureLastSampleValid = false;
+    // the sequence count jumped, so the next interval is measured from the
+    // next clock
 }
 
 void isrClockCapture(q_t sequenceSample, q_t watchdogSample) {
@@ -236,7 +815,20 @@ void isrClockCapture(q_t sequenceSample, q_t watchdogSample) {
   if (clockMode == modeInternal)
     return;
 
-  INC_COUNTER(countClockISR);
+  q_t late = backdateCapture(sequenceSample, watchdogSample);
+  recordCapture(sequenceSample, watchdogSample);
+
+  if (captureDetecting) {
+    int perBeat = detectClockRate(watchdogSample);
+    if (perBeat == 0)
+      return;
+
+    setCaptureRate(perBeat);
+    captureDetecting = false;
+    positionDetected(perBeat);
+    setState(clockPaused);
+      // then start up, just as if unpausing
+  }
 
   switch (clockState) {
 
@@ -244,92 +836,158 @@ void isrClockCapture(q_t sequenceSample, q_t watchdogSample) {
       q_t qdiff = watchdogSample - captureWatchdogStartCount;
 
       uint32_t dNext =
-        roundingDivide((uint32_t)activeDivisor * qdiff, captureClkQ);
+        captureClkQReciprocal.roundingDivide((uint32_t)activeDivisor * qdiff);
 
       if (!(divisorMin <= dNext && dNext <= divisorMax)) {
           // still perplexed
-          INC_COUNTER(countStillPerplexed);
-
-          captureWatchdogStartCount = resetWatchdog(4 * Q_PER_B);
+          captureWatchdogStartCount = resetWatchdog(perplexedWait(qdiff));
           break;
       }
-      INC_COUNTER(countUnPerplexing);
-      DEC_COUNTER(countUnpausing);
       // back to normal, act like un-pausing
       // fall through
     }
 
     case clockPaused: {
-      INC_COUNTER(countUnpausing);
+      statsUnpause();
 
       zeroCapture();
+      if (captureStartAt) {
+        moveCapture(sequenceSample, captureStartAt - 1);
+          // the master is some clocks in, so the outputs start from there,
+          // and only those due there trigger
+        sequenceSample = captureStartAt;
+      }
       setState(clockSyncRunning);
-      resetWatchdog(4 * Q_PER_B);
+      resetWatchdog(unpausedWait());
         // on restart, the rate isn't established
         // so don't interpret slower than expected as stopped
 
-      captureLastSample = 0;
+      if (late)
+        moveCapture(sequenceSample, 0);
+          // the outputs started from here, but the clock came before
+      captureLastSample = captureStartAt;
+      captureStartAt = 0;
       captureLastSampleValid = true;
+      captureSequencePeriod = activeTiming.sequence;
+        // so that the next edge isn't taken for a change in period
       break;
     }
 
     case clockSyncRunning: {
+      if (captureFlywheel > 0) {
+        // back from coasting through a dropout, the next interval will be
+        // measured from here, and the phase pulled back in smoothly
+        captureFlywheel = 0;
+        captureLastSampleValid = false;
+        resetWatchdog(clockWait());
+      }
+
       if (captureSequencePeriod != activeTiming.sequence) {
         captureSequencePeriod = activeTiming.sequence;
         captureLastSampleValid = false;
           // can't rely on last sanple if period changd
-        INC_COUNTER(countRunningChangePeriod);
       }
 
-      INC_COUNTER(countRunningInvalid);
       if (captureLastSampleValid) {
-        DEC_COUNTER(countRunningInvalid);
-
-        q_t qdiff =
-          (sequenceSample + captureSequencePeriod - captureLastSample)
-          % captureSequencePeriod;
-
-        uint32_t dNext =
-          roundingDivide((uint32_t)activeDivisor * qdiff, captureClkQ);
+        q_t qdiff = sequenceSample - captureLastSample;
+        if (sequenceSample < captureLastSample)
+          qdiff += captureSequencePeriod;
+          // both samples are within the period, so no need for modulo
+
+        uint32_t dNext8 =
+          captureClkQReciprocal.roundingDivide8((uint32_t)activeDivisor * qdiff);
+        uint32_t dNext = (dNext8 + 128) >> 8;
+
+        if (pllSelected != configuration.options.pllSync)
+          zeroCapture();
+            // start afresh with the other estimator, as at a new rate
+
+        if (captureCount > 0 && captureOutlier(dNext)) {
+          if (captureOutliers < captureOutlierLimit) {
+            captureOutliers += 1;
+            statsOutlier();
+            updateJitter(qdiff);
+              // dropped from the tempo, but the watchdog has to allow for it
+            resetWatchdog(clockWait()
+              + (qdiff < captureClkQ ? captureClkQ - qdiff : 0));
+              // an early edge doesn't bring the next one forward
+            captureLastSample = sequenceSample;
+              // the next interval is measured from this edge, so that both
+              // halves of a doubled edge are dropped
+            break;
+          }
+          zeroCapture();
+            // start afresh at the new rate
+        }
+        captureOutliers = 0;
 
         if (!(runningDivisorMin <= dNext && dNext <= runningDivisorMax)) {
-          INC_COUNTER(countRunningPerplexed);
+          statsPerplexed();
           setState(clockPerplexed);
-          captureWatchdogStartCount = resetWatchdog(4 * Q_PER_B);
-            // on perplexed, wait much long for absence of clock to signal paused
+          postEvent(eventClockPerplexed);
+          startDetecting();
+          captureWatchdogStartCount = resetWatchdog(perplexedWait(qdiff));
+            // on perplexed, wait longer for absence of clock to signal paused
             // setting of the watchdog timer is the new last sample
           break;
         }
 
-        // record this in the capture buffer, and average it with up to
+        if (captureFastAcquire && captureCount == 0
+            && divisorMin <= dNext && dNext <= divisorMax) {
+          primeCapture(dNext8);
+            // only if solidly in range, otherwise let the buffer fill
+          sequenceSample = rephaseCapture(sequenceSample);
+        }
+
+        // record this in the capture buffer, and total it with up to
         // captureBufferBeats' worth of measurements
-        captureSum += dNext;
+        captureSum += dNext8;
         if (captureCount >= captureBufferSpan) {
           captureSum -= captureBuffer[captureNext];
         } else {
           captureCount += 1;
         }
-        captureBuffer[captureNext] = (divisor_t)dNext;
-
-        // compute the average ext clk rate over the last captureBufferBeats
-        uint32_t dFilt = roundingDivide(captureSum, (uint32_t)captureCount);
-        captureHistory[captureNext] = (divisor_t)dFilt;
-
-        captureNext = (captureNext + 1) % captureBufferSpan;
+        captureBuffer[captureNext] = dNext8;
+        slopeUpdate(dNext8);
+        updateJitter(qdiff);
 
         // phase error (in Q)
-        q_t phase = sequenceSample % captureClkQ;
+        q_t phase = sequenceSample
+          - captureClkQ * captureClkQReciprocal.divide(sequenceSample);
         if (phase >= captureClkQHalf)
           phase -= captureClkQ;
 
-        // adjust filterd divisor to fix the phase error over one beat
-        uint32_t dAdj = roundingDivide(dFilt * Q_PER_B, Q_PER_B - phase);
-        dAdj = constrain(dAdj, runningDivisorMin, runningDivisorMax);
+        uint32_t dFilt8;
+        uint32_t dAdj8;
 
-        setDivisors((divisor_t)dFilt, (divisor_t)dAdj);
+        if (configuration.options.pllSync) {
+          pllUpdate(dNext8, phase, dFilt8, dAdj8);
+        } else {
+          // compute the average ext clk rate over the last captureBufferBeats
+          dFilt8 = slopeAdjustAverage(captureAverage8(), captureCount);
+
+          // adjust filterd divisor to fix the phase error over one beat
+          uint32_t d = (dFilt8 + 128) >> 8;
+          dAdj8 = dFilt8 + ((phaseCorrect(d, phase) - d) << 8);
+            // the correction is made on the whole divisor, as in fixed point
+            // it could overflow at low clock rates
+        }
+        dFilt8 = constrain(dFilt8,
+          (uint32_t)runningDivisorMin << 8, (uint32_t)runningDivisorMax << 8);
+        dAdj8 = constrain(dAdj8,
+          (uint32_t)runningDivisorMin << 8, (uint32_t)runningDivisorMax << 8);
+
+        uint32_t dFilt = (dFilt8 + 128) >> 8;
+        captureFilt8 = dFilt8;
+        captureHistory[captureNext] = (divisor_t)dFilt;
+        captureNext += 1;
+        if (captureNext >= captureBufferSpan)
+          captureNext = 0;
+
+        setDivisors((divisor_t)dFilt, ditherDivisor(dAdj8));
+        statsEdge(qdiff, phase, activeDivisor);
         setState(clockSyncRunning);
-        resetWatchdog(captureClkQWait);
-        INC_COUNTER(countRuningWell);
+        resetWatchdog(clockWait());
       }
 
       captureLastSample = sequenceSample;
@@ -344,11 +1002,12 @@ void isrClockCapture(q_t sequenceSample, q_t watchdogSample) {
 
 ClockStatus ClockStatus::current() {
   static auto updateAt = millis() - 1; // ensure update the first time
-  static float reportedBpmf = 0;
+  static uint32_t reportedBpm1600 = 0;
+    // hundredths of a BPM, with 4 more bits, so that the slew gets close
   static bpm_t reportedBpm = 0;
-  static const float fastThreasholdDeltaBpmf = 1.0f;
+  static const uint32_t fastThreasholdDeltaBpm1600 = 100 << 4;
     // If moving faster than this, then just jump
-    // TODO: Consider setting this lower to 0.5f
+    // TODO: Consider setting this lower to 0.5 bpm
     // That is good enough for the Digitakt, but too low for the the
     // janky clock divider test rig I have
 
@@ -356,22 +1015,26 @@ ClockStatus ClockStatus::current() {
   if (updateAt < now) {
     updateAt = max(updateAt + 100, now + 10);
       // recompute only 10x a second, on a regular basis, but don't get behind
+      // the rest of the time, this just returns the same status
 
-    auto targetBpmf = divisorToBpm(targetDivisor);
-    if (fabsf(targetBpmf - reportedBpmf) < fastThreasholdDeltaBpmf) {
+    uint32_t targetBpm1600 = divisorToBpm100(targetDivisor) << 4;
+    uint32_t delta = targetBpm1600 > reportedBpm1600
+      ? targetBpm1600 - reportedBpm1600
+      : reportedBpm1600 - targetBpm1600;
+    if (delta < fastThreasholdDeltaBpm1600) {
       // moving a little bit, so just slew slowly
-      reportedBpmf = (10.0f * reportedBpmf + targetBpmf) / 11.0f;
+      reportedBpm1600 = (10 * reportedBpm1600 + targetBpm1600 + 5) / 11;
     } else {
       // moved a lot
-      reportedBpmf = targetBpmf;
+      reportedBpm1600 = targetBpm1600;
     }
 
-    reportedBpm = (bpm_t)(roundf(reportedBpmf));
+    reportedBpm = (bpm_t)((reportedBpm1600 + (50 << 4)) / (100 << 4));
 
     if (configuration.debug.plotClock) {
       // for plotting on the IDE plotter
-      int targetBpm100 = (int)(roundf(100.0f * targetBpmf));
-      int reportedBpm100 = (int)(roundf(100.0f * reportedBpmf));
+      int targetBpm100 = (int)(targetBpm1600 >> 4);
+      int reportedBpm100 = (int)((reportedBpm1600 + 8) >> 4);
 
       Serial.printf(
         "targetf:%d.%02d reportedf:%d.%02d reported:%d\n",
@@ -387,6 +1050,26 @@ ClockStatus ClockStatus::current() {
 
 
 void initializeClock() {
+  // as at power up, so that the host tests can start over
+  clockMode = modeFirsttime;
+  clockState = clockPaused;
+  activeDivisor = 0;
+  targetDivisor = 0;
+  captureAuto = false;
+  captureDetecting = false;
+  captureStartAt = 0;
+  pendingExternalClocksPerBeatChange = false;
+  setCaptureRate(0);
+  zeroCapture();
+  captureFlywheel = 0;
+  captureSequencePeriod = 0;
+  midiLate = 0;
+  midiLateBefore = 0;
+  midiSlack = 0;
+
+  zeroSyncStats();
+  captureCountReciprocals.initialize();
+
   if (configuration.options.extendedBpmRange)
     setBpmRange(10, 900);
   else
@@ -395,14 +1078,49 @@ void initializeClock() {
 
 void setBpm(bpm_t bpm) {
   bpm = constrain(bpm, bpmMin, bpmMax);
-  divisor_t d = divisorFromBpm((float)bpm);
+  divisor_t d = divisorFromBpm100(bpm * 100u);
+  setDivisors(d, d);
+}
+
+void setBeatPeriod(uint32_t micros) {
+  divisor_t d = divisorFromBeatMicros(micros);
+  d = constrain(d, divisorMin, divisorMax);
   setDivisors(d, d);
 }
 
+void alignBeat(uint32_t microsSinceBeat) {
+  if (clockMode != modeInternal)
+    return;
+
+  const uint32_t ticksPerMicro = F_CPU / 1000000;
+  q_t qSinceBeat = microsSinceBeat * ticksPerMicro / activeDivisor;
+
+  PauseQuantum pq;
+  Timing timing = snapshotTiming();
+
+  Offsets counts;
+  readCounts(counts);
+
+  // the tap is a beat of the measure, whatever B is playing, so move the
+  // sequence such that its beat has been running for qSinceBeat, and the
+  // outputs follow from the sequence: The beat unit divides the sequence,
+  // and the move is to the nearest such beat, so the measures stay on the
+  // beats they were on, even in 5/8
+  q_t unit = timing.beatUnit;
+  q_t shift = ((qSinceBeat % unit) + unit - (counts.countS % unit)) % unit;
+  if (shift > unit / 2)
+    shift += timing.sequence - unit;    // back, as that is nearer
+  counts.countS = (counts.countS + shift) % timing.sequence;
+  adjustOffsets(timing, counts);
+
+  writeCounts(counts);
+}
+
 void setSync(SyncMode sync) {
   int clocksPerBeat = 0;
   switch (sync) {
     case syncFixed: clocksPerBeat = 0; break;
+    case syncAuto:  clocksPerBeat = clocksPerBeatAuto; break;
     default:
       if (sync & syncExternalFlag) {
         clocksPerBeat = sync & syncPPQNMask;
@@ -411,10 +1129,72 @@ void setSync(SyncMode sync) {
       }
   }
 
+  midiSync = sync == syncMidiUSB;
+  midiRunning = true;
+  midiSlack = 0;
+  setExtClkSource(midiSync ? extClkSoftware : extClkInput);
+
   setClockRate(clocksPerBeat);
   setMode(sync == syncFixed ? modeInternal : modeExtenral);
 }
 
+void midiClock(uint32_t arrivedAt) {
+  if (!(midiSync && midiRunning))
+    return;
+
+  const uint32_t ticksPerMicro = F_CPU / 1000000;
+  uint32_t lateMicros = static_cast<uint32_t>(micros()) - arrivedAt;
+  midiLate = lateMicros * ticksPerMicro / activeDivisor;
+  midiSlack = midiSlackMicros * ticksPerMicro / activeDivisor;
+  softwareExtClk();
+}
+
+void midiStart() {
+  midiPosition(0);
+  midiRunning = true;
+}
+
+void midiContinue() {
+  midiRunning = true;
+}
+
+void midiStop() {
+  midiRunning = false;
+  if (!midiSync)
+    return;
+
+  noInterrupts();
+    // the clock state belongs to the interrupt service routines, but with
+    // them held off, it is safe to pause it here
+  if (clockState != clockPaused)
+    pauseCapture();
+  interrupts();
+}
+
+void midiPosition(uint16_t sixteenths) {
+  if (!midiSync)
+    return;
+
+  noInterrupts();
+  bool paused = clockState == clockPaused;
+  interrupts();
+  if (!paused)
+    return;   // the MIDI spec only allows this when stopped
+
+  // just "before" the position, so the first clock after continuing
+  // triggers the outputs there, as with pausing
+  q_t q = sixteenths * (Q_PER_B / 4);
+  Timing timing = snapshotTiming();
+  Offsets counts;
+  counts.countS = (q + timing.periodS - 1) % timing.periodS;
+  counts.countM = (q + timing.periodM - 1) % timing.periodM;
+  counts.countB = (q + timing.cycleB - 1) % timing.cycleB;
+  counts.countT = (q + timing.cycleT - 1) % timing.cycleT;
+
+  PauseQuantum pq;
+  writeCounts(counts);
+}
+
 #pragma GCC diagnostic pop
 
 
@@ -428,23 +1208,42 @@ void resetTiming(const State& state) {
 }
 
 void updateTiming(const State& state) {
-  computePeriods(state, activeTiming);
-  {
-    PauseQuantum pq;
-
-    Offsets counts;
-    readCounts(counts);
-    adjustOffsets(activeTiming, counts);
-    writePeriods(activeTiming, targetDivisor);
-    writeCounts(counts);
+  Timing timing;
+  computePeriods(state, timing);
+  if (quantumShift(timing) == quantumShift(activeTiming)) {
+    stagePeriods(timing, targetDivisor);
+    return;
   }
+
+  // A change of quantum shift changes the quantum timer's prescaler, which
+  // can only be written with the timer disabled. So rather than at the
+  // boundary, from the measure interrupt, it is done now, paused, keeping
+  // the outputs where they are. This costs a little time, but only
+  // happens for the longest settings.
+  unstagePeriods();
+  PauseQuantum pq;
+  Offsets counts;
+  readCounts(counts);
+  adjustOffsets(timing, counts);
+  writePeriods(timing, targetDivisor);
+  writeCounts(counts);
+  activeTiming = timing;
 }
 
-#if 0
-void midiClock() {
-  simulateExtClk();
+bool timingPending() {
+  return stagedPeriodsPending();
+}
+
+void cancelTiming(const State& state) {
+  // if the staged periods were applied before they could be dropped, the
+  // state's own periods have to be staged to put things back
+  if (!unstagePeriods())
+    updateTiming(state);
+}
+
+void isrPeriodsApplied(const Timing& timing) {
+  activeTiming = timing;
 }
-#endif
 
 
 void dumpClock() {
@@ -470,8 +1269,8 @@ void dumpClock() {
   Serial.printf("captureSum = %d\n", captureSum);
   Serial.printf("captureCount = %d\n", captureCount);
 
-  int activeBpm100 = (int)(roundf(100.0f * divisorToBpm(activeDivisor)));
-  int targetBpm100 = (int)(roundf(100.0f * divisorToBpm(targetDivisor)));
+  int activeBpm100 = (int)divisorToBpm100(activeDivisor);
+  int targetBpm100 = (int)divisorToBpm100(targetDivisor);
 
   Serial.printf("active: %3d.%02d bpm - %5d divisor  |  "
                 "target: %3d.%02d bpm - %5d divisor\n",
@@ -492,17 +1291,24 @@ void dumpClock() {
     case clockFreeRunning:  Serial.println("free running");   break;
   }
 
-#if DEBUG_ISR
-  Serial.printf("countWatchdogISR = %d\n", countWatchdogISR);
-  Serial.printf("countClockISR = %d\n", countClockISR);
-  Serial.printf("countUnpausing = %d\n", countUnpausing);
-  Serial.printf("countStillPerplexed = %d\n", countStillPerplexed);
-  Serial.printf("countUnPerplexing = %d\n", countUnPerplexing);
-  Serial.printf("countRunningChangePeriod = %d\n", countRunningChangePeriod);
-  Serial.printf("countRunningInvalid = %d\n", countRunningInvalid);
-  Serial.printf("countRunningPerplexed = %d\n", countRunningPerplexed);
-  Serial.printf("countRuningWell = %d\n", countRuningWell);
+  uint32_t lockedEdges = syncStats.lockedEdges;
+  Serial.printf("sync: %d edges, %d unpauses, %d perplexes, %d outliers, "
+                "%d dropouts, %d locks\n",
+    syncStats.edges, syncStats.unpauses, syncStats.perplexes,
+    syncStats.outliers, syncStats.dropouts, syncStats.locks);
+  Serial.printf("lock time: last %dq, max %dq\n",
+    syncStats.lastLockQ, syncStats.maxLockQ);
+  if (lockedEdges > 0) {
+    Serial.printf("locked: %d edges, phase error max %dq, mean %dq, "
+                  "divisor %d ~ %d\n",
+      lockedEdges, syncStats.maxPhaseError,
+      roundingDivide(syncStats.sumPhaseError, lockedEdges),
+      syncStats.minDivisor, syncStats.maxDivisor);
+  }
 
-  zeroDebugCounts();
-#endif
+  noInterrupts();
+  zeroSyncStats();
+  interrupts();
+
+  dumpCaptureRecords();
 }
@@ -45,16 +45,35 @@ void setBpm(bpm_t);
   // sync back to externally driven tempo.
 void setSync(SyncMode);
 
-// void midiClock();
+void setBeatPeriod(uint32_t);
+  // in microseconds, finer grained than setBpm()
+void alignBeat(uint32_t);
+  // when free running, shift the outputs so that the beat started this
+  // many microseconds ago
+
+void midiClock(uint32_t arrivedAt);   // in micros()
+void midiStart();
+void midiContinue();
+void midiStop();
+void midiPosition(uint16_t);  // in sixteenth notes
+  // for syncMidiUSB, from loop()
 
 void resetTiming(const State&);
 void updateTiming(const State&);
+  // takes effect at the next measure boundary, or right away if the
+  // quantum has to be rescaled, see quantumShift()
+bool timingPending();
+  // true until the last updateTiming() has taken effect
+void cancelTiming(const State&);
+  // undoes updateTiming(), going back to the state given
 
 
 // ISR routines
 
 void isrClockCapture(q_t, q_t);
 void isrWatchdog();
+void isrReset();
+void isrPeriodsApplied(const Timing&);
 
 
 void dumpClock();
@@ -15,7 +15,17 @@ namespace {
 
   int selectedField = 0;
   const int minField = 0;
-  const int maxField = 9;
+  const int maxField = 11;
+
+  void nextFlywheelBeats() {
+    switch (configuration.flywheelBeats) {
+      case 0:   configuration.flywheelBeats = 1; break;
+      case 1:   configuration.flywheelBeats = 2; break;
+      case 2:   configuration.flywheelBeats = 4; break;
+      case 4:   configuration.flywheelBeats = 8; break;
+      default:  configuration.flywheelBeats = 0; break;
+    }
+  }
 
   bool clickSelectedField() {
     switch (selectedField) {
@@ -24,18 +34,20 @@ namespace {
         return true;
 
       case 1: configuration.options.extendedBpmRange ^= 1; break;
-      case 2: configuration.options.alwaysDim        ^= 1; break;
-      case 3: configuration.options.saverDisable     ^= 1; break;
-      case 4: configuration.debug.waitForSerial     ^= 1; break;
-      case 5: configuration.debug.flash             ^= 1; break;
-      case 6: configuration.debug.timing            ^= 1; break;
-      case 7: configuration.debug.plotClock         ^= 1; break;
-
-      case 8:
+      case 2: configuration.options.pllSync          ^= 1; break;
+      case 3: nextFlywheelBeats();                         break;
+      case 4: configuration.options.alwaysDim        ^= 1; break;
+      case 5: configuration.options.saverDisable     ^= 1; break;
+      case 6: configuration.debug.waitForSerial     ^= 1; break;
+      case 7: configuration.debug.flash             ^= 1; break;
+      case 8: configuration.debug.timing            ^= 1; break;
+      case 9: configuration.debug.plotClock         ^= 1; break;
+
+      case 10:
         testLoop();
         break;
 
-      case 9:
+      case 11:
         flashTestAndReset();
         break;
 
@@ -60,6 +72,14 @@ namespace {
     display.setTextColor(WHITE, BLACK);
   }
 
+  void drawValue(const char* s, int v, int field) {
+    if (selectedField == field)
+      display.setTextColor(BLACK, WHITE);
+    display.print(s);
+    display.print(v);
+    display.setTextColor(WHITE, BLACK);
+  }
+
   void drawConfiguration() {
     display.clearDisplay();
     display.setTextColor(WHITE, BLACK);
@@ -76,27 +96,30 @@ namespace {
 
     // options line
     display.setCursor(0, 8);
-    display.print("Opts: ");
+    display.print("Opts:");
     drawFlag("extBPM", configuration.options.extendedBpmRange, 1);
+    drawFlag("pll", configuration.options.pllSync, 2);
+    display.print(" ");
+    drawValue("fly", configuration.flywheelBeats, 3);
 
     // screen line
     display.setCursor(0, 16);
     display.print("Screen: ");
-    drawFlag("dim", configuration.options.alwaysDim, 2);
+    drawFlag("dim", configuration.options.alwaysDim, 4);
     display.print(" ");
-    drawFlag("saver", !configuration.options.saverDisable, 3);
+    drawFlag("saver", !configuration.options.saverDisable, 5);
 
     // debug line
     display.setCursor(0, 24);
     display.print("Debug: ");
-    drawFlag("w", configuration.debug.waitForSerial, 4);
-    drawFlag("f", configuration.debug.flash, 5);
-    drawFlag("t", configuration.debug.timing, 6);
-    drawFlag("p", configuration.debug.plotClock, 7);
+    drawFlag("w", configuration.debug.waitForSerial, 6);
+    drawFlag("f", configuration.debug.flash, 7);
+    drawFlag("t", configuration.debug.timing, 8);
+    drawFlag("p", configuration.debug.plotClock, 9);
     display.print(" ");
-    drawButton("hw", 8);
+    drawButton("hw", 10);
     display.print(" ");
-    drawButton("xx", 9);
+    drawButton("xx", 11);
 
     display.display();
   }
@@ -9,7 +9,8 @@ struct Configuration {
     uint8_t alwaysDim:1;
     uint8_t saverDisable:1;
     uint8_t extendedBpmRange:1;
-    uint8_t :5;
+    uint8_t pllSync:1;
+    uint8_t :4;
   } options;
 
   struct {
@@ -20,7 +21,10 @@ struct Configuration {
     uint8_t :4;
   } debug;
 
-  uint8_t reserved1;
+  uint8_t flywheelBeats;
+    // beats to keep running through an external clock dropout, 0 is off
+    // (was a reserved byte, always zero)
+
   uint8_t reserved2;
 
   static void initialize();
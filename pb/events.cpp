@@ -0,0 +1,56 @@
+#include "events.h"
+
+#include <atomic>
+
+#include <Arduino.h>
+
+
+namespace {
+  const uint8_t ringSize = 16;      // must be a power of two
+  Event ring[ringSize];
+
+  volatile uint8_t ringHead = 0;    // next to post, written only by posting
+  volatile uint8_t ringTail = 0;    // next to take, written only by taking
+
+  uint32_t droppedEvents = 0;
+
+  inline uint8_t ringNext(uint8_t i) {
+    return (uint8_t)((i + 1) & (ringSize - 1));
+  }
+}
+
+void postEvent(EventType type) {
+  uint8_t head = ringHead;
+  uint8_t next = ringNext(head);
+
+  if (next == ringTail) {
+    droppedEvents += 1;
+    return;
+  }
+
+  ring[head].type = type;
+  ring[head].at = millis();
+
+  std::atomic_signal_fence(std::memory_order_release);
+    // the event must be written before it is made visible
+  ringHead = next;
+}
+
+bool takeEvent(Event& event) {
+  uint8_t tail = ringTail;
+  if (tail == ringHead)
+    return false;
+
+  std::atomic_signal_fence(std::memory_order_acquire);
+  event = ring[tail];
+
+  std::atomic_signal_fence(std::memory_order_release);
+    // the event must be read before the slot is given back
+  ringTail = ringNext(tail);
+  return true;
+}
+
+void dumpEvents() {
+  Serial.printf("events: %d pending, %d dropped\n",
+    (ringHead - ringTail) & (ringSize - 1), droppedEvents);
+}
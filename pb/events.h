@@ -0,0 +1,34 @@
+#ifndef _INCLUDE_EVENTS_H_
+#define _INCLUDE_EVENTS_H_
+
+#include <stdint.h>
+
+/*
+  Events are passed from the interrupt service routines to loop() through a
+  small ring buffer. It is lock free as there is a single producer and a
+  single consumer: Only the interrupt service routines post events, and as
+  they all run at the same priority, they never preempt each other. Only
+  loop() takes events.
+*/
+
+enum EventType : uint8_t {
+  eventMeasure,         // the sequence has passed a measure boundary
+  eventClockLost,       // the external clock stopped, so the clock paused
+  eventClockLocked,     // the clock has locked on to the external clock
+  eventClockPerplexed,  // the external clock is out of range
+};
+
+struct Event {
+  EventType type;
+  uint32_t  at;         // millis() when posted
+};
+
+void postEvent(EventType);
+  // only call from interrupt service routines
+
+bool takeEvent(Event&);
+  // only call from loop(), returns false if there are no more events
+
+void dumpEvents();
+
+#endif // _INCLUDE_EVENTS_H_
@@ -0,0 +1,86 @@
+#include "isr_stats.h"
+
+#include <Arduino.h>
+
+
+IsrStats::IsrStats() {
+  zero();
+}
+
+void IsrStats::record(uint32_t cycles, bool b2b) {
+  count += 1;
+  if (b2b) backToBack += 1;
+  if (cycles < minCycles) minCycles = cycles;
+  if (cycles > maxCycles) maxCycles = cycles;
+  sumCycles += cycles;
+
+  int bin = 0;
+  for (uint32_t c = cycles >> 1; c && bin < bins - 1; c >>= 1)
+    bin += 1;
+  histogram[bin] += 1;
+}
+
+void IsrStats::zero() {
+  count = 0;
+  backToBack = 0;
+  minCycles = UINT32_MAX;
+  maxCycles = 0;
+  sumCycles = 0;
+  for (auto& h : histogram) h = 0;
+}
+
+void IsrStats::dump(const char* name) const {
+  if (count == 0) {
+    Serial.printf("%s isr: no runs\n", name);
+    return;
+  }
+
+  Serial.printf("%s isr: %u runs, %u back-to-back\n", name,
+    count, backToBack);
+  Serial.printf("    cycles min %u, mean %u, max %u\n",
+    minCycles, (uint32_t)(sumCycles / count), maxCycles);
+  Serial.print("    hist:");
+  for (int i = 0; i < bins; ++i) {
+    if (histogram[i])
+      Serial.printf(" <%u:%u", 2u << i, histogram[i]);
+  }
+  Serial.println();
+}
+
+
+#if defined(__SAMD21__)
+
+// SysTick counts CPU cycles down from LOAD, reloading every millisecond.
+
+uint32_t isrTimestamp() {
+  return SysTick->VAL;
+}
+
+uint32_t isrCyclesSince(uint32_t start) {
+  uint32_t now = SysTick->VAL;
+  return start >= now ? start - now : start + (SysTick->LOAD + 1) - now;
+}
+
+bool isrTimerPending() {
+  return NVIC->ISPR[0]
+    & ((1u << TCC0_IRQn) | (1u << TC3_IRQn) | (1u << TC5_IRQn));
+}
+
+#else
+
+uint32_t isrSimulatedCycles = 0;
+bool isrSimulatedPending = false;
+
+uint32_t isrTimestamp() {
+  return isrSimulatedCycles;
+}
+
+uint32_t isrCyclesSince(uint32_t start) {
+  return isrSimulatedCycles - start;
+}
+
+bool isrTimerPending() {
+  return isrSimulatedPending;
+}
+
+#endif // __SAMD21__
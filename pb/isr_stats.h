@@ -0,0 +1,62 @@
+#ifndef _INCLUDE_ISR_STATS_H_
+#define _INCLUDE_ISR_STATS_H_
+
+#include <stdint.h>
+
+/*
+  Execution time statistics for interrupt service routines.
+
+  These are always compiled in, and cost a few dozen cycles per interrupt.
+  On the SAMD21 the timestamps are CPU cycles read from SysTick. Off the
+  hardware, the timestamps come from isrSimulatedCycles, which a simulation
+  advances as it sees fit.
+*/
+
+class IsrStats {
+public:
+  IsrStats();
+
+  void record(uint32_t cycles, bool backToBack);
+  void zero();
+  void dump(const char* name) const;
+
+  inline uint32_t runs() const { return count; }
+  inline uint32_t mostCycles() const { return maxCycles; }
+  inline double meanCycles() const
+    { return count ? (double)sumCycles / count : 0; }
+  inline uint32_t backToBackRuns() const { return backToBack; }
+
+private:
+  static const int bins = 16;     // bin n counts runs of 2^n to 2^(n+1)-1
+
+  uint32_t count;
+  uint32_t backToBack;    // another timer interrupt was pending at exit
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint64_t sumCycles;
+  uint32_t histogram[bins];
+};
+
+
+uint32_t isrTimestamp();
+uint32_t isrCyclesSince(uint32_t);
+bool isrTimerPending();
+
+#if !defined(__SAMD21__)
+extern uint32_t isrSimulatedCycles;
+extern bool isrSimulatedPending;
+#endif
+
+
+class IsrTiming {
+  // place one at the top of an interrupt service routine
+public:
+  inline IsrTiming(IsrStats& s) : stats(s), start(isrTimestamp()) { }
+  inline ~IsrTiming() { stats.record(isrCyclesSince(start), isrTimerPending()); }
+
+private:
+  IsrStats& stats;
+  const uint32_t start;
+};
+
+#endif // _INCLUDE_ISR_STATS_H_
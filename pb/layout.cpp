@@ -126,18 +126,45 @@ namespace {
 
   const int16_t x_pw = x_pins + 4;
 
+  // S is always the sequence, the others can be routed from any source
+  auto outputModeT = OutputModeField(x_pinT + 4, 0, 15, 11, userState().outputModeT,
+    { otuputTuplet, outputSequence, outputMeasure, outputBeat,
+      outputFixed4, outputFixed8, outputFixed16, outputFixed32 });
+  auto outputModeB = OutputModeField(x_pinB + 4, 0, 15, 11, userState().outputModeB,
+    { outputBeat, otuputTuplet,
+      outputFixed4, outputFixed8, outputFixed16, outputFixed32 });
+      // the beat timer is only 16 bits, too short for measures
+  auto outputModeM = OutputModeField(x_pinM + 4, 0, 15, 11, userState().outputModeM,
+    { outputMeasure, outputSequence, outputBeat, otuputTuplet,
+      outputFixed4, outputFixed8, outputFixed16, outputFixed32 });
+
+  // in place of the dot for each output, so the dot shows when it is x1
+  auto outputFactorT = OutputFactorField(x_pinT + 4, 11, 15, 8, userState().outputFactorT);
+  auto outputFactorB = OutputFactorField(x_pinB + 4, 11, 15, 8, userState().outputFactorB);
+  auto outputFactorM = OutputFactorField(x_pinM + 4, 11, 15, 8, userState().outputFactorM);
+
   auto pulseWitdhT = PulseWidthField(x_pinT + 4, 19, 15, 12, userState().pulseWidthT);
   auto pulseWitdhB = PulseWidthField(x_pinB + 4, 19, 15, 12, userState().pulseWidthB);
   auto pulseWitdhM = PulseWidthField(x_pinM + 4, 19, 15, 12, userState().pulseWidthM);
   auto pulseWitdhS = PulseWidthField(x_pinS + 4, 19, 15, 12, userState().pulseWidthS);
 
+  auto fieldSwing
+    = SwingField(111, 11, 17, 20, userState().swing);
+
   const std::initializer_list<Field*> setupFields =
     { &fieldReturnToMain,
       &fieldSync,
+      &outputModeT,
+      &outputFactorT,
       &pulseWitdhT,
+      &outputModeB,
+      &outputFactorB,
       &pulseWitdhB,
+      &outputModeM,
+      &outputFactorM,
       &pulseWitdhM,
-      &pulseWitdhS
+      &pulseWitdhS,
+      &fieldSwing
     };
 
 
@@ -197,16 +224,14 @@ namespace {
     smallText();
     display.setTextColor(WHITE, BLACK);
 
-    display.setCursor(x_pinT + 9, 2);    display.print('T');
-    display.setCursor(x_pinB + 9, 2);    display.print('B');
-    display.setCursor(x_pinM + 9, 2);    display.print('M');
+    // T, B, and M are labeled by their output mode fields
     display.setCursor(x_pinS + 9, 2);    display.print('S');
 
+    display.setCursor(113, 2);           display.print("SW");
+
     resetText();
 
-    display.fillCircle(x_pinT + 11, 14, 2, WHITE);
-    display.fillCircle(x_pinB + 11, 14, 2, WHITE);
-    display.fillCircle(x_pinM + 11, 14, 2, WHITE);
+    // T, B, and M have their dots drawn by their output factor fields
     display.fillCircle(x_pinS + 11, 14, 2, WHITE);
 
   }
@@ -0,0 +1,73 @@
+#include "midi.h"
+
+
+MidiParser::MidiParser()
+  : status(0), dataCount(0), data0(0), songPosition(0)
+  { }
+
+MidiMessage MidiParser::parse(uint8_t b) {
+  if (b >= 0xf8) {
+    // real time, doesn't affect any message in progress
+    switch (b) {
+      case 0xf8:  return midiMsgClock;
+      case 0xfa:  return midiMsgStart;
+      case 0xfb:  return midiMsgContinue;
+      case 0xfc:  return midiMsgStop;
+      default:    return midiMsgNone;
+    }
+  }
+
+  if (b & 0x80) {
+    status = b;
+    dataCount = 0;
+    return midiMsgNone;
+  }
+
+  if (status == 0xf2) {
+    if (dataCount == 0) {
+      data0 = b;
+      dataCount = 1;
+    } else {
+      songPosition = (uint16_t)(data0 | (b << 7));
+      status = 0;     // system common messages have no running status
+      dataCount = 0;
+      return midiMsgPosition;
+    }
+  }
+
+  return midiMsgNone;
+}
+
+
+MidiClockStamps::MidiClockStamps()
+  : stamped(0), taken(0)
+  { }
+
+void MidiClockStamps::received(
+    const uint8_t* packets, uint32_t length, uint32_t at) {
+  for (uint32_t i = 0; i + 4 <= length; i += 4) {
+    // code index number 0xF, a single byte, on cable 0
+    if (packets[i] == 0x0f && packets[i + 1] == 0xf8) {
+      stamps[stamped % maxStamps] = at;
+      stamped = stamped + 1;
+        // after the stamp, see take()
+    }
+  }
+}
+
+bool MidiClockStamps::take(uint32_t& at) {
+  uint32_t n = taken++;
+  at = stamps[n % maxStamps];
+  uint32_t ahead = stamped - n;
+    // read after the stamp, see below
+
+  if (int32_t(ahead) <= 0) {
+    // the interrupt missed a clock, so this one has no stamp, and the next
+    // one parsed gets the next stamp
+    taken = stamped;
+    return false;
+  }
+
+  // else, unless it was overwritten, allowing for one in progress
+  return ahead < maxStamps;
+}
@@ -0,0 +1,76 @@
+#ifndef _INCLUDE_MIDI_H_
+#define _INCLUDE_MIDI_H_
+
+#include <stdint.h>
+
+// USB MIDI sync needs the usbmidi library, so is off by default. Build with
+// -DPB_MIDI_USB=1 (for example, via compiler.cpp.extra_flags in
+// platform.local.txt) to enable it.
+#ifndef PB_MIDI_USB
+#define PB_MIDI_USB 0
+#endif
+
+enum MidiMessage : uint8_t {
+  midiMsgNone,
+  midiMsgClock,         // 0xF8, 24 per beat
+  midiMsgStart,         // 0xFA
+  midiMsgContinue,      // 0xFB
+  midiMsgStop,          // 0xFC
+  midiMsgPosition,      // 0xF2, Song Position Pointer, see position()
+};
+
+/*
+  Picks the sync related messages out of a MIDI byte stream. All other
+  messages are ignored. Real time messages may appear anywhere, even between
+  the data bytes of another message, as per the MIDI spec.
+
+  This has no dependencies on the Arduino environment.
+*/
+
+class MidiParser {
+public:
+  MidiParser();
+
+  MidiMessage parse(uint8_t);
+
+  inline uint16_t position() const { return songPosition; }
+    // of the last midiMsgPosition, in sixteenth notes (six clocks)
+
+private:
+  uint8_t   status;       // of the current message, or zero if none
+  uint8_t   dataCount;
+  uint8_t   data0;
+  uint16_t  songPosition;
+};
+
+/*
+  The arrival times of clocks, so that they can be captured as of when they
+  arrived, rather than when loop() gets around to parsing them.
+
+  The USB interrupt calls received() with each transfer on the MIDI
+  endpoint, which holds four byte USB MIDI event packets. loop() calls
+  take() for each clock the parser finds, in the same order. A clock with
+  no stamp, because the interrupt didn't see it or loop() fell so far behind
+  that it was overwritten, gets none.
+
+  This has no dependencies on the Arduino environment.
+*/
+
+class MidiClockStamps {
+public:
+  MidiClockStamps();
+
+  void received(const uint8_t* packets, uint32_t length, uint32_t at);
+    // from the USB interrupt
+  bool take(uint32_t& at);
+    // the arrival of the next clock parsed, false if it wasn't stamped
+
+private:
+  static const uint32_t maxStamps = 16;
+
+  volatile uint32_t stamps[maxStamps];
+  volatile uint32_t stamped;    // clocks stamped, only the interrupt writes
+  uint32_t          taken;      // clocks taken, only loop() writes
+};
+
+#endif // _INCLUDE_MIDI_H_
@@ -1,6 +1,8 @@
 // #include <ZeroRegs.h>
 
-#if 0
+#include "midi.h"
+
+#if PB_MIDI_USB
 #include <usbmidi.h>
 #endif
 
@@ -9,6 +11,7 @@
 #include "controls.h"
 #include "critical.h"
 #include "display.h"
+#include "events.h"
 #include "layout.h"
 #include "state.h"
 #include "timer_hw.h"
@@ -18,14 +21,14 @@
 ZeroRegOptions zeroOpts = { Serial, true };
 #endif
 
-volatile bool measureEvent = false;
-
 void isrMeasure() {
-  measureEvent = true;
+  postEvent(eventMeasure);
 }
 
 extern "C" char* sbrk(int incr);
 
+void initializeMidi();   // below, with the rest of the MIDI code
+
 uint32_t sramUsed() {
   return (uint32_t)(sbrk(0)) - 0x20000000;
 }
@@ -54,6 +57,7 @@ void setup() {
   initializeState();
   initializeTimers();
   initializeClock();
+  initializeMidi();
 
   setBpm(userState().userBpm);
   setSync(userState().syncMode);
@@ -74,17 +78,122 @@ void setup() {
 }
 
 
+#if PB_MIDI_USB
+MidiParser midiParser;
+MidiClockStamps midiClockStamps;
+
+// From the Arduino SAMD core, USBCore.cpp: replaces the USB interrupt
+// handler, which is otherwise USBDevice.ISRHandler().
+extern void USB_SetHandler(void (*)(void));
+
+void usbHandler() {
+  // Stamp the clocks in each transfer as it completes, before the USB core
+  // handles the interrupt. The data is in the endpoint's buffer by then.
+  uint32_t at = micros();
+  auto descriptors =
+    reinterpret_cast<UsbDeviceDescriptor*>(USB->DEVICE.DESCADD.reg);
+
+  for (int ep = 1; ep < USB_EPT_NUM; ++ep) {
+    auto& endpoint = USB->DEVICE.DeviceEndpoint[ep];
+    if (!(endpoint.EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT0))
+      continue;
+    if (endpoint.EPCFG.bit.EPTYPE0 != 3)
+      continue;   // not a bulk OUT endpoint
+#ifdef CDC_ENDPOINT_OUT
+    if (ep == CDC_ENDPOINT_OUT)
+      continue;
+#endif
+
+    auto& bank = descriptors[ep].DeviceDescBank[0];
+    midiClockStamps.received(
+      reinterpret_cast<const uint8_t*>(bank.ADDR.reg),
+      bank.PCKSIZE.bit.BYTE_COUNT, at);
+  }
+
+  USBDevice.ISRHandler();
+}
+
+void initializeMidi() {
+  USB_SetHandler(usbHandler);
+}
+
+void midiClockArrived() {
+  uint32_t at;
+  if (!midiClockStamps.take(at))
+    at = micros();
+  midiClock(at);
+}
+
+void pollMidi() {
+  USBMIDI.poll();
+  while (USBMIDI.available()) {
+    switch (midiParser.parse(USBMIDI.read())) {
+      case midiMsgClock:      midiClockArrived();                   break;
+      case midiMsgStart:      midiStart();                          break;
+      case midiMsgContinue:   midiContinue();                       break;
+      case midiMsgStop:       midiStop();                           break;
+      case midiMsgPosition:   midiPosition(midiParser.position());  break;
+      case midiMsgNone:                                             break;
+    }
+  }
+}
+#else
+void initializeMidi() { }
+inline void pollMidi() { }
+#endif
+
+
 void loop() {
   bool active = false;
+  bool measured = false;
+
+  pollMidi();
+    // first, as any delay here is jitter in the MIDI clock
+
+  Event event;
+  while (takeEvent(event)) {
+    switch (event.type) {
+      case eventMeasure:
+        measured = true;
+        break;
+
+      case eventClockLost:
+      case eventClockLocked:
+      case eventClockPerplexed:
+        if (configuration.debug.timing) {
+          Serial.printf("clock %s @ %dms\n",
+            event.type == eventClockLost ? "lost"
+              : event.type == eventClockLocked ? "locked" : "perplexed",
+            event.at);
+        }
+        active = true;
+        break;
+    }
+  }
 
-  if (measureEvent) {
-    measureEvent = false;
-    if (pendingState()) {
-      updateTiming(userState());
+  // Changes are staged as soon as they are made, and take effect on the
+  // next measure boundary. Only then are they committed.
+  static State stagedState;
+  static bool staged = false;   // stagedState is on the timers, or will be
+
+  if (pendingState()) {
+    if (!staged || memcmp(&stagedState, &userState(), sizeof(State)) != 0) {
+      fitOutputs(userState());
+        // the output fields only offer what fits, but other settings can
+        // change the periods the outputs are factored from
+      stagedState = userState();
+      staged = true;
+      updateTiming(stagedState);
+    } else if (measured && !timingPending()) {
       commitState();
+      staged = false;
       active = true;
     }
-  } else {
+  } else if (staged) {
+    // the user went back to the active state before the change committed
+    cancelTiming(activeState());
+    staged = false;
+  } else if (!measured) {
     auto status = ClockStatus::current();
     if (status.running() && userState().userBpm != status.bpm) {
       userState().userBpm = status.bpm;
@@ -99,23 +208,6 @@ void loop() {
     case Critical::closed: drawAll(true); break;
   }
 
-#if 0
-  USBMIDI.poll();
-  while (USBMIDI.available()) {
-    auto b = USBMIDI.read();
-
-    if (b == 0xf8) {
-      midiClock();
-
-      static bool reported = false;
-      if (!reported) {
-        Serial.println("MIDI clock detected");
-        reported = true;
-      }
-    }
-  }
-#endif
-
   auto update = encoder.update();
   if (update.active()) {
     updateSelection(update);
@@ -152,6 +244,7 @@ void loop() {
     Serial.println("-------------------------------------------------------");
     dumpTimers();
     dumpClock();
+    dumpEvents();
     active = true;
   }
 
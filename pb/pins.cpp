@@ -16,7 +16,7 @@
 
   Input pins:
     EXT CLK:                    PB08        15, PIN_A1
-    OTHER:                      PB09        16, PIN_A2
+    OTHER (reset):              PB09        16, PIN_A2
 
 
   NB: If you want to change the pin assignments, then you must carefully
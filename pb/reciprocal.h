@@ -0,0 +1,84 @@
+#ifndef _INCLUDE_RECIPROCAL_H_
+#define _INCLUDE_RECIPROCAL_H_
+
+#include <stdint.h>
+
+/*
+  The SAMD21 has no hardware divider, so in the interrupt service routines
+  division by a value that changes rarely is done as a multiply by a
+  precomputed reciprocal (see Granlund & Montgomery, "Division by Invariant
+  Integers using Multiplication"). With m = ceil(2^(31+L) / q), where
+  2^L >= q, the quotient is exact for all x < 2^31.
+
+  This has no dependencies on the Arduino environment.
+*/
+
+constexpr uint8_t ceilLog2(uint32_t q, uint8_t l = 0) {
+  return ((uint32_t)1 << l) >= q ? l : ceilLog2(q, (uint8_t)(l + 1));
+}
+
+struct Reciprocal {
+  uint32_t  half;
+  uint32_t  m;
+  uint8_t   shift;
+
+  constexpr Reciprocal(uint32_t q)
+    : half(q / 2),
+      m((uint32_t)((((uint64_t)1 << (31 + ceilLog2(q))) + q - 1) / q)),
+      shift((uint8_t)(31 + ceilLog2(q)))
+    { }
+
+  inline uint32_t divide(uint32_t x) const
+    { return (uint32_t)(((uint64_t)x * m) >> shift); }
+
+  inline uint32_t roundingDivide(uint32_t x) const
+    { return divide(x + half); }
+
+  // x / q, rounded, with 8 bits of fraction: within one of exact for q > 128
+  inline uint32_t roundingDivide8(uint32_t x) const
+    { return (uint32_t)
+        (((uint64_t)x * m + ((uint64_t)1 << (shift - 9))) >> (shift - 8)); }
+
+  // x * q / (q - p), for |p| < q / 2, and x * |p| < 2^31
+  //
+  // Computed as the series x * (1 + r + r^2 + r^3), where r = p / q. Each
+  // term is rounded, and the remainder of the series is x * r^4 / (1 - r),
+  // so the result is within 3 of exact, plus r^3 of the change from x.
+  inline uint32_t scaleByComplement(uint32_t x, int32_t p) const {
+    bool negative = p < 0;
+    uint32_t a = negative ? (uint32_t)-p : (uint32_t)p;
+
+    uint32_t c1 = roundingDivide(x * a);
+    uint32_t c2 = roundingDivide(c1 * a);
+    uint32_t c3 = roundingDivide(c2 * a);
+
+    return negative
+      ? x - c1 + c2 - c3
+      : x + c1 + c2 + c3;
+  }
+};
+
+
+/*
+  Division by a small count, such as for averaging up to N values, is done
+  with a table of ceil(2^31 / n). The rounded quotient is within one of
+  exact, for any x + n / 2 < 2^31.
+*/
+
+template< int N >
+struct CountReciprocals {
+  uint32_t  m[N + 1];
+
+  void initialize() {
+    m[0] = 0;
+    for (uint32_t n = 1; n <= N; ++n)
+      m[n] = (uint32_t)((((uint64_t)1 << 31) + n - 1) / n);
+  }
+
+  inline uint32_t roundingDivide(uint32_t x, int n) const {
+    x += (uint32_t)(n / 2);
+    return (uint32_t)(((uint64_t)x * m[n]) >> 31);
+  }
+};
+
+#endif // _INCLUDE_RECIPROCAL_H_
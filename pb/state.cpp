@@ -19,6 +19,8 @@ namespace {
     const T& data() const { return _box._data; }
 
   private:
+    static_assert(sizeof(T) <= maxSize, "data doesn't fit the container");
+
     static const uint32_t MAGIC = 1284161520 + maxSize;
 
     struct Box {
@@ -172,6 +174,10 @@ bool pendingOutputSettings() {
     || _userState.outputModeM != _activeState.outputModeM
     || _userState.outputModeB != _activeState.outputModeB
     || _userState.outputModeT != _activeState.outputModeT
+    || _userState.outputFactorM != _activeState.outputFactorM
+    || _userState.outputFactorB != _activeState.outputFactorB
+    || _userState.outputFactorT != _activeState.outputFactorT
+    || _userState.swing != _activeState.swing
     ;
 }
 
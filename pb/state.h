@@ -34,6 +34,11 @@ enum SyncMode : uint8_t {
   sync48ppqn = 0xb0,   // clock = 48ppqn DIN sync
 
   syncMidiUSB = 0xd8,     // clock = 24ppqn MIDI sync over USB
+
+  syncAuto = 0xc0,        // clock = rate detected from the incoming clock
+    // -- the rate that gives the tempo nearest the current one, so a clock
+    // much faster or slower than that is taken at another rate: from 120
+    // bpm, 48ppqn at 75 bpm reads as 24ppqn at 150, see clock.cpp
 };
 
 enum PulseWidth : uint8_t {
@@ -53,8 +58,26 @@ enum OutputMode : uint8_t {
   outputMeasure   = 0x01,
   outputBeat      = 0x02,
   otuputTuplet    = 0x03,
+
+  // fixed note values, independent of the settings
+  outputFixedFlag = 0x40,   // high bits indicate a fixed note value
+  outputNoteMask  = 0x3f,   // lower 6 bits are the note value
+
+  outputFixed4    = 0x44,   // quarter notes
+  outputFixed8    = 0x48,   // eighth notes
+  outputFixed16   = 0x50,   // sixteenth notes
+  outputFixed32   = 0x60,   // 32nd notes
 };
 
+typedef int8_t OutputFactor;
+  // positive n multiplies the rate of the output by n, negative n divides it
+  // supported: 2, 3, 4, 6, 8, and their negatives
+
+const OutputFactor outputFactorNone = 0;   // as is 1 and -1
+
+const uint8_t swingNone = 0;   // as is 50, older saves read as zero
+const uint8_t swingMax = 75;
+
 struct State {
   Settings    settings;
   uint8_t     memoryIndex;
@@ -71,6 +94,14 @@ struct State {
   OutputMode  outputModeM = outputMeasure;
   OutputMode  outputModeB = outputBeat;
   OutputMode  outputModeT = otuputTuplet;
+
+  // also in V2, as older saves read these as zero, which is x1
+  OutputFactor  outputFactorM = outputFactorNone;
+  OutputFactor  outputFactorB = outputFactorNone;
+  OutputFactor  outputFactorT = outputFactorNone;
+
+  uint8_t     swing = swingNone;    // percent of a pair of B & T periods
+                                    // given to the first, also from V2
 };
 
 // Settings and the memory index are buffered:
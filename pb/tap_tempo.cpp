@@ -0,0 +1,60 @@
+#include "tap_tempo.h"
+
+
+TapTempo::TapTempo() {
+  reset();
+}
+
+void TapTempo::reset() {
+  count = 0;
+  next = 0;
+  estimate = 0;
+}
+
+void TapTempo::tap(uint32_t at) {
+  if (count > 0 && at - lastTap() > timeout)
+    reset();
+
+  taps[next] = at;
+  next = (next + 1) % maxTaps;
+  if (count < maxTaps)
+    count += 1;
+
+  if (count >= minTaps)
+    computeEstimate();
+}
+
+void TapTempo::computeEstimate() {
+  uint32_t intervals[maxTaps - 1];
+  int n = count - 1;
+
+  // collect the intervals, insertion sorting them as they go
+  int t = (next + maxTaps - count) % maxTaps;
+  for (int i = 0; i < n; ++i) {
+    int u = (t + 1) % maxTaps;
+    uint32_t d = taps[u] - taps[t];
+    t = u;
+
+    int j = i;
+    for (; j > 0 && intervals[j - 1] > d; --j)
+      intervals[j] = intervals[j - 1];
+    intervals[j] = d;
+  }
+
+  uint32_t median = intervals[(n - 1) / 2];
+    // the lower of the middle two, if even, so it is one of the intervals
+
+  // average those within a quarter of the median
+  uint32_t tolerance = median / 4;
+  uint32_t sum = 0;
+  uint32_t used = 0;
+  for (int i = 0; i < n; ++i) {
+    uint32_t d = intervals[i];
+    if (median - tolerance <= d && d <= median + tolerance) {
+      sum += d;
+      used += 1;
+    }
+  }
+
+  estimate = (sum + used / 2) / used;   // the median itself is always used
+}
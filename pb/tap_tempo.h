@@ -0,0 +1,43 @@
+#ifndef _INCLUDE_TAP_TEMPO_H_
+#define _INCLUDE_TAP_TEMPO_H_
+
+#include <stdint.h>
+
+/*
+  Estimates a tempo from taps.
+
+  The estimate is the median of the intervals between the last few taps,
+  refined by averaging just those intervals near the median. So a missed
+  or doubled tap doesn't throw it off. A pause longer than the slowest
+  tempo starts over.
+
+  Times are in microseconds. This has no dependencies on the Arduino
+  environment.
+*/
+
+class TapTempo {
+public:
+  TapTempo();
+
+  void tap(uint32_t at);
+  void reset();
+
+  inline bool ready() const { return estimate != 0; }
+  inline uint32_t interval() const { return estimate; }
+    // microseconds per beat, only valid if ready()
+  inline uint32_t lastTap() const { return taps[(next + maxTaps - 1) % maxTaps]; }
+
+private:
+  static const int maxTaps = 8;
+  static const int minTaps = 3;
+  static const uint32_t timeout = 2500000;    // a bit longer than 30 bpm
+
+  uint32_t  taps[maxTaps];
+  int       count;
+  int       next;
+  uint32_t  estimate;
+
+  void computeEstimate();
+};
+
+#endif // _INCLUDE_TAP_TEMPO_H_
@@ -4,37 +4,46 @@
 
 #include <Arduino.h>
 
-#include "pins.h"
+#include "isr_stats.h"
 
 
 namespace {
-  const float cpuFactor = 60.0f * F_CPU / Q_PER_B;
+  const uint32_t cpuFactor100 =
+    (uint32_t)((6000ull * F_CPU + Q_PER_B / 2) / Q_PER_B);
+    // divisor * bpm100, kept in integers as the M0 has no floating point
 }
 
-float divisorToBpm(divisor_t divisor) {
-  return cpuFactor / (float)divisor;
+bpm100_t divisorToBpm100(divisor_t divisor) {
+  return divisor ? (cpuFactor100 + divisor / 2) / divisor : 0;
 }
 
-divisor_t divisorFromBpm(float bpm) {
-  return (divisor_t)(roundf(cpuFactor / bpm));
+divisor_t divisorFromBpm100(bpm100_t bpm100) {
+  return (divisor_t)((cpuFactor100 + bpm100 / 2) / bpm100);
 }
 
-namespace {
+divisor_t divisorFromBeatMicros(uint32_t micros) {
+  const uint32_t ticksPerMicro = F_CPU / 1000000;
+  uint32_t d = (micros * ticksPerMicro + Q_PER_B / 2) / Q_PER_B;
+  return (divisor_t)(min(d, (uint32_t)0xffff));
+}
 
+namespace {
   const uint32_t cpuTicksInMinWidth = F_CPU / 1000 * 2667 / 1000;
     // ticks_sec / ms_per_sec * width_in_micros / micros_per_ms
     // Becareful to keep this calc. from over- or under- flowing!
+}
 
-  q_t divisorToMinWidth(divisor_t divisor) {
-    return max(6, divisor ? cpuTicksInMinWidth / divisor : 0);
-      // handle zero divisor at start, and also make sure always sane
-  }
+q_t divisorToMinWidth(divisor_t divisor) {
+  return max(6, divisor ? cpuTicksInMinWidth / divisor : 0);
+    // handle zero divisor at start, and also make sure always sane
 }
 
 
 // *** NOTE: This implementation is for the SAMD21 only.
 #if defined(__SAMD21__) || defined(TC4) || defined(TC5)
 
+#include "pins.h"
+
 /* Timer Diagram:
 
   QUANTUM -+-> event --+--> BEAT --> waveform
@@ -52,6 +61,11 @@ namespace {
            +-> event ----> WATCHDOG --> timeout
                            (TC3)
 
+  EXT CLK -> event ------> SEQUENCE capture
+
+  RESET ---> event ------> SEQUENCE, MEASURE, TUPLET retrigger
+                           (BEAT is retriggered by the SEQUENCE interrupt)
+
   Note on synchonization:
 
   TC units: No sync is required by the MCU as the bus and CPU will just stall
@@ -74,6 +88,7 @@ namespace {
   Tcc* const tupletTcc = TCC2;
 
 
+#define RESET_EVENT_CHANNEL       4
 #define QUANTUM_A_EVENT_CHANNEL   5
 #define QUANTUM_B_EVENT_CHANNEL   6
 #define EXTCLK_EVENT_CHANNEL      7
@@ -111,6 +126,22 @@ namespace {
       | EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_EIC_EXTINT_8)
       | EVSYS_CHANNEL_PATH_ASYNCHRONOUS
       ;
+
+    for ( uint16_t user :
+          { EVSYS_ID_USER_TCC0_EV_1,
+            EVSYS_ID_USER_TCC1_EV_1,
+            EVSYS_ID_USER_TCC2_EV_1}
+        ) {
+      EVSYS->USER.reg
+        = EVSYS_USER_USER(user)
+        | EVSYS_USER_CHANNEL(RESET_EVENT_CHANNEL + 1)
+        ;
+    }
+    EVSYS->CHANNEL.reg
+      = EVSYS_CHANNEL_CHANNEL(RESET_EVENT_CHANNEL)
+      | EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_EIC_EXTINT_9)
+      | EVSYS_CHANNEL_PATH_ASYNCHRONOUS
+      ;
   }
 
   bool quantumRunning = false;
@@ -150,38 +181,52 @@ PauseQuantum::~PauseQuantum()
   { if (wasRunning) startQuantumEvents(); }
 
 
-#if 0
-void simulateExtClk() {
-  static bool firstTime = true;
+namespace {
+  ExtClkSource extClkSource = extClkInput;
+}
+
+void setExtClkSource(ExtClkSource source) {
+  if (source == extClkSource)
+    return;
+  extClkSource = source;
 
-  if (firstTime) {
+  if (source == extClkSoftware) {
+    // software events need the synchronous path, and so a clock
     GCLK->CLKCTRL.reg
       = GCLK_CLKCTRL_CLKEN
       | GCLK_CLKCTRL_GEN_GCLK0
-      | GCLK_CLKCTRL_ID(GCM_EVSYS_CHANNEL_6);
+      | GCLK_CLKCTRL_ID(GCM_EVSYS_CHANNEL_0 + EXTCLK_EVENT_CHANNEL);
 
-    EVSYS->CTRL.reg
-      = EVSYS_CTRL_GCLKREQ
-      ;
-
-    EVSYS->USER.reg
-      = EVSYS_USER_USER(EVSYS_ID_USER_TCC0_MC_1)
-      | EVSYS_USER_CHANNEL(EXTCLK_EVENT_CHANNEL + 1)
-      ;
     EVSYS->CHANNEL.reg
       = EVSYS_CHANNEL_CHANNEL(EXTCLK_EVENT_CHANNEL)
       | EVSYS_CHANNEL_PATH_SYNCHRONOUS
       | EVSYS_CHANNEL_EDGSEL_RISING_EDGE
       ;
+  } else {
+    EVSYS->CHANNEL.reg
+      = EVSYS_CHANNEL_CHANNEL(EXTCLK_EVENT_CHANNEL)
+      | EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_EIC_EXTINT_8)
+      | EVSYS_CHANNEL_PATH_ASYNCHRONOUS
+      ;
 
-    firstTime = false;
+    GCLK->CLKCTRL.reg
+      = GCLK_CLKCTRL_GEN_GCLK0
+      | GCLK_CLKCTRL_ID(GCM_EVSYS_CHANNEL_0 + EXTCLK_EVENT_CHANNEL);
   }
+}
+
+void softwareExtClk() {
+  if (extClkSource != extClkSoftware)
+    return;
+
+  // the sequence timer captures its count, just as for the clock input
   EVSYS->CHANNEL.reg
-      = EVSYS_CHANNEL_CHANNEL(EXTCLK_EVENT_CHANNEL)
-      | EVSYS_CHANNEL_SWEVT
-      ;
+    = EVSYS_CHANNEL_CHANNEL(EXTCLK_EVENT_CHANNEL)
+    | EVSYS_CHANNEL_PATH_SYNCHRONOUS
+    | EVSYS_CHANNEL_EDGSEL_RISING_EDGE
+    | EVSYS_CHANNEL_SWEVT
+    ;
 }
-#endif
 
 namespace {
   // NOTE: All TC units are used in 16 bit mode.
@@ -226,12 +271,15 @@ namespace {
     tcc->EVCTRL.reg
       = TCC_EVCTRL_TCEI0
       | TCC_EVCTRL_EVACT0_COUNTEV
+      | TCC_EVCTRL_TCEI1
+      | TCC_EVCTRL_EVACT1_RETRIGGER
       | ((tcc == sequenceTcc) ? TCC_EVCTRL_MCEI1 : 0)
       ;
 
     if (tcc == sequenceTcc) {
       tcc->INTENSET.reg =
-        TCC_INTENSET_OVF | TCC_INTENSET_MC1 | TCC_INTENSET_MC2;
+        TCC_INTENSET_OVF | TCC_INTENSET_TRG
+        | TCC_INTENSET_MC1 | TCC_INTENSET_MC2;
     }
 
     tcc->WEXCTRL.reg
@@ -258,24 +306,168 @@ namespace {
     sync(tcc, TCC_SYNCBUSY_ENABLE);
   }
 
-  q_t activeSequence;
-  q_t activeMeasure;
+  // When the periods are too long for the timers, the quantum timer is
+  // prescaled so that each quantum event is 2^activeShift Q, and all values
+  // written to or read from the counters are in those units. This is
+  // hidden from the rest of the code, which always works in Q.
+  uint8_t activeShift = 0;
+
+  inline q_t toCounter(q_t q, uint8_t shift)  { return q >> shift; }
+  inline q_t toCounter(q_t q)   { return toCounter(q, activeShift); }
+  inline q_t fromCounter(q_t c) { return c << activeShift; }
+  inline q_t widthToCounter(q_t q, uint8_t shift)
+    { return (q + (q_t(1) << shift) - 1) >> shift; }
+    // rounded up, so that the width doesn't fall below the minimum
+
+  inline q_t widthRegister(q_t minQ, q_t width, uint8_t shift)
+    { return widthToCounter(max(minQ, width), shift) - 1; }
+
+  void setShift(uint8_t shift) {
+    // only with the quantum paused, see writePeriods()
+    if (shift == activeShift)
+      return;
+
+    // the prescaler is enable protected, this only happens when the
+    // settings need it, and then the change in rate is what is wanted
+    quantumTc->COUNT16.CTRLA.reg &= ~TC_CTRLA_ENABLE;
+    sync(quantumTc);
+    quantumTc->COUNT16.CTRLA.bit.PRESCALER = shift;
+      // DIV1, DIV2, DIV4, DIV8 are 0 through 3
+    enable(quantumTc);
+
+    // the watchdog counts the same quantum events, so what it has left to
+    // wait is rescaled to the new rate
+    q_t left = 0x10000 - qcast(watchdogTc->COUNT16.COUNT.reg);
+    left = (left << activeShift) >> shift;
+    watchdogTc->COUNT16.COUNT.reg =
+      static_cast<uint16_t>(0x10000 - constrain(left, 1, 0x10000));
+
+    activeShift = shift;
+  }
+
+  // The measure boundaries of a timing, so the measure interrupt can step
+  // to the next without dividing. Entry i is the start of the measure
+  // after measure i, or zero after the last measure. One table is active,
+  // the other is built by stagePeriods() for the timing to come.
+  // outputsFit() allows no more measures than these hold.
+  const int maxMeasures = maxNumberMeasures;
+
+  struct MeasureTable {
+    q_t at[maxMeasures];      // in counter units
+    int count;
+  };
+
+  MeasureTable  measureTables[2];
+  MeasureTable* activeMeasures = &measureTables[0];
+  int           measureIndex = 0;     // the measure playing
+
+  inline MeasureTable& inactiveMeasures() {
+    return activeMeasures == &measureTables[0]
+      ? measureTables[1] : measureTables[0];
+  }
+
+  void buildMeasureTable(MeasureTable& table, q_t measure, q_t sequence) {
+    table.count = 1;
+    if (measure) {
+      for (q_t m = measure;
+          m < sequence && table.count < maxMeasures;
+          m += measure)
+        table.at[table.count++ - 1] = m;
+    }
+    table.at[table.count - 1] = 0;
+      // zero doesn't work for CC match, BUT interrupt on overflow is
+      // effectively the same thing, so it is caught.
+  }
+
+  inline int measureIndexAt(const MeasureTable& table, q_t position) {
+    int i = 0;
+    while (i < table.count - 1 && table.at[i] <= position)
+      ++i;
+    return i;
+  }
 
   inline q_t nextMeasure(q_t currSequence) {
-    auto m =
-      activeMeasure
-        ? (currSequence - currSequence % activeMeasure) + activeMeasure
-        : 0;
-    if (m >= activeSequence)
-      m = 0;
-        // zero doesn't work for CC match, BUT interrupt on overflow is
-        // effectively the same thing, so it is caught.
-    return m;
+    measureIndex = measureIndexAt(*activeMeasures, currSequence);
+    return activeMeasures->at[measureIndex];
+  }
+
+  inline q_t stepMeasure(bool overflowed) {
+    measureIndex = overflowed ? 0 : measureIndex + 1;
+    return measureIndex < activeMeasures->count
+      ? activeMeasures->at[measureIndex] : 0;
+  }
+
+  // Shadow of the sequence timer's CC[2]. When the measure interrupt fires
+  // the sequence position is known without reading the count: it is zero on
+  // overflow, and this on compare match. Reading the count would take a
+  // READSYNC round trip, spinning in the interrupt.
+  q_t measureCompare = 0;
+
+  inline void writeMeasureCompare(q_t m) {
+    measureCompare = m;
+    sync(sequenceTcc, TCC_SYNCBUSY_CC2);
+    sequenceTcc->CC[2].reg = m;
+  }
+}
+
+
+namespace {
+  // Swing alternates the B & T periods, see Timing. The tuplet TCC does
+  // this in hardware, with its circular period buffer. The beat TC has no
+  // such buffer, so its overflow interrupt swaps the period. It only has
+  // to run before the count reaches the new top, so the outputs don't
+  // depend on its latency.
+
+  struct SwingPair {
+    q_t first;        // in counter units, both zero when not swung
+    q_t second;
+  };
+
+  SwingPair beatSwing = { 0, 0 };
+  SwingPair tupletSwing = { 0, 0 };
+  volatile bool beatSecond = false;   // the beat is in its second period
+
+  void setSwingPair(SwingPair& pair, q_t cycle, q_t swung, uint8_t shift) {
+    pair.first = swung ? toCounter(swung, shift) : 0;
+    pair.second = swung ? toCounter(cycle - swung, shift) : 0;
+  }
+
+  uint16_t beatTop = 0;     // shadow of the beat TC's CC[0]
+
+  inline void writeBeatTop(q_t top) {
+    beatTop = static_cast<uint16_t>(top);
+    beatTc->COUNT16.CC[0].reg = beatTop;
+    beatTc->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;
+      // any overflow already pending is for the old period
+  }
+
+  inline void writeBeatTop() {
+    writeBeatTop((beatSecond ? beatSwing.second : beatSwing.first) - 1);
+  }
+
+  inline void writeTupletPeriods(bool second) {
+    sync(tupletTcc, TCC_SYNCBUSY_PER | TCC_SYNCBUSY_PERB);
+    tupletTcc->PER.reg  = (second ? tupletSwing.second : tupletSwing.first) - 1;
+    tupletTcc->PERB.reg = (second ? tupletSwing.first : tupletSwing.second) - 1;
+      // swapped by the circular buffer at the end of each period
+  }
+
+  void restartSwing() {
+    // after the counters have been retriggered by the reset input
+    if (beatSwing.first) {
+      beatSecond = false;
+      writeBeatTop();
+    }
+    if (tupletSwing.first)
+      writeTupletPeriods(false);
   }
 }
 
 
 void readCounts(Offsets& counts) {
+  // Only called with the quantum paused, or for debugging, so the wait for
+  // read sync doesn't matter. The measure interrupt doesn't use this.
+
   // request read sync, with command written to ctrlb
   sync(sequenceTcc, TCC_SYNCBUSY_CTRLB);
   sync(measureTcc, TCC_SYNCBUSY_CTRLB);
@@ -293,24 +485,52 @@ void readCounts(Offsets& counts) {
   sync(sequenceTcc, TCC_SYNCBUSY_COUNT);
   sync(measureTcc, TCC_SYNCBUSY_COUNT);
   sync(tupletTcc, TCC_SYNCBUSY_COUNT);
-  counts.countS = sequenceTcc->COUNT.reg;
-  counts.countM = measureTcc->COUNT.reg;
-  counts.countB = qcast(beatTc->COUNT16.COUNT.reg);
-  counts.countT = tupletTcc->COUNT.reg;
+  counts.countS = fromCounter(sequenceTcc->COUNT.reg);
+  counts.countM = fromCounter(measureTcc->COUNT.reg);
+  q_t b = qcast(beatTc->COUNT16.COUNT.reg);
+  if (beatSwing.first && beatSecond)
+    b += beatSwing.first;
+
+  q_t t = tupletTcc->COUNT.reg;
+  if (tupletSwing.first) {
+    sync(tupletTcc, TCC_SYNCBUSY_PER);
+    if (tupletTcc->PER.reg == tupletSwing.second - 1)
+      t += tupletSwing.first;
+  }
+
+  counts.countB = fromCounter(b);
+  counts.countT = fromCounter(t);
 }
 
 void writeCounts(const Offsets& counts) {
-  // sync as a group - though quantum is stopped, so shouldn't matter
+  // sync as a group - the quantum is either stopped, or this is from the
+  // measure interrupt, just after a quantum, so there is time before the next
   sync(sequenceTcc, TCC_SYNCBUSY_COUNT | TCC_SYNCBUSY_CC2);
   sync(measureTcc, TCC_SYNCBUSY_COUNT);
   sync(tupletTcc, TCC_SYNCBUSY_COUNT);
 
-  sequenceTcc->COUNT.reg = counts.countS;
-  measureTcc->COUNT.reg = counts.countM;
-  beatTc->COUNT16.COUNT.reg = static_cast<uint16_t>(counts.countB);
-  tupletTcc->COUNT.reg = counts.countT;
+  q_t b = toCounter(counts.countB);
+  if (beatSwing.first) {
+    beatSecond = b >= beatSwing.first;
+    if (beatSecond)
+      b -= beatSwing.first;
+    writeBeatTop();
+  }
+
+  q_t t = toCounter(counts.countT);
+  if (tupletSwing.first) {
+    bool second = t >= tupletSwing.first;
+    if (second)
+      t -= tupletSwing.first;
+    writeTupletPeriods(second);
+  }
+
+  sequenceTcc->COUNT.reg = toCounter(counts.countS);
+  measureTcc->COUNT.reg = toCounter(counts.countM);
+  beatTc->COUNT16.COUNT.reg = static_cast<uint16_t>(b);
+  tupletTcc->COUNT.reg = t;
 
-  sequenceTcc->CC[2].reg = nextMeasure(counts.countS);
+  writeMeasureCompare(nextMeasure(toCounter(counts.countS)));
 }
 
 void zeroCounts() {
@@ -320,51 +540,369 @@ void zeroCounts() {
 
 namespace {
   q_t lastBeatWidth = 0;
+
+  // the timing on the counters, and the divisor for their widths
+  Timing    appliedTiming;
+  divisor_t widthDivisor = 0;
+
+  // Periods staged by stagePeriods() are applied by the measure interrupt,
+  // at the next measure boundary, with the quantum running. A count written
+  // after the next quantum has come sets that output back a quantum for
+  // good, and at 300 BPM a quantum is under 1000 cycles. So stagePeriods()
+  // works out everything beforehand, in loop(), from the boundary the
+  // measure compare is set for. The TCC periods and widths wait in their
+  // buffer registers, held there by LUPD, and the interrupt only writes
+  // the counts and forces the update.
+  //
+  // Of each count and period, whichever keeps the count within the period
+  // goes first: should a quantum come between the two writes, a count past
+  // the period would run on to 2^24, or 2^16 for the beat.
+  struct StagedWrites {
+    q_t       countS;           // all in counter units
+    q_t       countM;
+    q_t       countB;           // within the period of a swung pair
+    q_t       countT;
+    bool      beatSecond;       // the count is in the second period
+    bool      tupletSecond;
+    bool      upS;              // the period is no shorter, so goes first
+    bool      upM;
+    bool      upT;
+    q_t       beatPeriod;       // when not swung
+    q_t       beatWidth;        // as for CC[1]
+    SwingPair beatSwing;
+    bool      tupletBuffered;   // else T swings, before or after, and its
+                                // circular buffer is written directly
+    q_t       tupletPeriod;     // when not swung
+    q_t       tupletWidth;      // as for CCB[0]
+    SwingPair tupletSwing;
+    int       measureIndex;     // in the inactive measure table
+  };
+
+  Timing        stagedTiming;
+  StagedWrites  staged;
+  volatile bool periodsStaged = false;
+  bool          tupletHeld = false;   // the tuplet TCC's buffers are staged
+
+  void stageWrites(const Timing& timing, divisor_t divisor, uint8_t shift,
+      q_t boundary, const MeasureTable& table, StagedWrites& w) {
+    Offsets counts;
+    counts.countS = boundary;
+    adjustOffsets(timing, counts);
+
+    q_t minQ = divisorToMinWidth(divisor);
+
+    w.countS = toCounter(counts.countS, shift);
+    w.countM = toCounter(counts.countM, shift);
+    w.upS = toCounter(timing.periodS, shift) >= toCounter(appliedTiming.periodS);
+    w.upM = toCounter(timing.periodM, shift) >= toCounter(appliedTiming.periodM);
+    w.measureIndex = measureIndexAt(table, w.countS);
+
+    setSwingPair(w.beatSwing, timing.cycleB, timing.swungB, shift);
+    w.countB = toCounter(counts.countB, shift);
+    w.beatSecond = w.beatSwing.first && w.countB >= w.beatSwing.first;
+    if (w.beatSecond)
+      w.countB -= w.beatSwing.first;
+    w.beatPeriod = toCounter(timing.periodB, shift);
+    w.beatWidth = widthRegister(minQ, timing.widthB, shift);
+
+    setSwingPair(w.tupletSwing, timing.cycleT, timing.swungT, shift);
+    w.countT = toCounter(counts.countT, shift);
+    w.tupletSecond = w.tupletSwing.first && w.countT >= w.tupletSwing.first;
+    if (w.tupletSecond)
+      w.countT -= w.tupletSwing.first;
+    w.tupletBuffered = !timing.swungT && !appliedTiming.swungT;
+    w.tupletPeriod = toCounter(timing.periodT, shift);
+    w.upT = w.tupletPeriod >= toCounter(appliedTiming.periodT);
+    w.tupletWidth = widthRegister(minQ, timing.widthT, shift);
+  }
+
+  inline void holdUpdates(Tcc* tcc) {
+    sync(tcc, TCC_SYNCBUSY_CTRLB);
+    tcc->CTRLBSET.reg = TCC_CTRLBSET_LUPD;
+  }
+
+  inline void releaseUpdates(Tcc* tcc) {
+    sync(tcc, TCC_SYNCBUSY_CTRLB);
+    tcc->CTRLBCLR.reg = TCC_CTRLBCLR_LUPD;
+  }
+
+  inline void forceUpdate(Tcc* tcc) {
+    releaseUpdates(tcc);
+    sync(tcc, TCC_SYNCBUSY_CTRLB);
+    tcc->CTRLBSET.reg = TCC_CTRLBSET_CMD_UPDATE;
+  }
+
+  inline void preload(Tcc* tcc, q_t period, q_t width) {
+    sync(tcc, TCC_SYNCBUSY_PERB | TCC_SYNCBUSY_CCB0);
+    tcc->PERB.reg = period - 1;
+    tcc->CCB[0].reg = width;
+  }
+
+  void restoreBuffers() {
+    // puts back what staged periods preloaded
+    q_t minQ = divisorToMinWidth(widthDivisor);
+    preload(sequenceTcc, toCounter(appliedTiming.periodS),
+      widthRegister(minQ, appliedTiming.widthS, activeShift));
+    preload(measureTcc, toCounter(appliedTiming.periodM),
+      widthRegister(minQ, appliedTiming.widthM, activeShift));
+    releaseUpdates(sequenceTcc);
+    releaseUpdates(measureTcc);
+
+    if (tupletHeld) {
+      preload(tupletTcc, toCounter(appliedTiming.periodT),
+        widthRegister(minQ, appliedTiming.widthT, activeShift));
+      releaseUpdates(tupletTcc);
+      tupletHeld = false;
+    }
+  }
+
+  inline void applyCount(Tcc* tcc, q_t count, bool up) {
+    if (up)
+      forceUpdate(tcc);
+    sync(tcc, TCC_SYNCBUSY_COUNT);
+    tcc->COUNT.reg = count;
+    if (!up)
+      forceUpdate(tcc);
+  }
+
+  void applyTupletDirect(bool reset) {
+    bool second = !reset && staged.tupletSecond;
+    const SwingPair& pair = staged.tupletSwing;
+    q_t per = pair.first
+      ? (second ? pair.second : pair.first) : staged.tupletPeriod;
+    q_t perb = pair.first
+      ? (second ? pair.first : pair.second) : staged.tupletPeriod;
+
+    sync(tupletTcc, TCC_SYNCBUSY_PER);
+    bool up = per - 1 >= tupletTcc->PER.reg;
+      // read, as the circular buffer may have swapped it
+    if (up)
+      tupletTcc->PER.reg = per - 1;
+    if (!reset) {
+      sync(tupletTcc, TCC_SYNCBUSY_COUNT);
+      tupletTcc->COUNT.reg = staged.countT;
+    }
+    if (!up) {
+      sync(tupletTcc, TCC_SYNCBUSY_PER);
+      tupletTcc->PER.reg = per - 1;
+    }
+
+    sync(tupletTcc,
+      TCC_SYNCBUSY_PERB | TCC_SYNCBUSY_CCB0 | TCC_SYNCBUSY_WAVE);
+    tupletTcc->PERB.reg = perb - 1;
+    tupletTcc->CCB[0].reg = staged.tupletWidth;
+    tupletTcc->WAVE.reg
+      = TCC_WAVE_WAVEGEN_NPWM
+      | (pair.first ? TCC_WAVE_CIPEREN : 0);
+  }
+
+  void applyStagedPeriods(bool reset) {
+    // From the measure interrupt, just after the quantum that reached the
+    // boundary, so the counts go first. On reset, the TCC counts have been
+    // zeroed by the input, and the beat's by the interrupt.
+
+    bool beatSecondNext = !reset && staged.beatSecond;
+    q_t top = (staged.beatSwing.first
+      ? (beatSecondNext ? staged.beatSwing.second : staged.beatSwing.first)
+      : staged.beatPeriod) - 1;
+
+    if (reset) {
+      forceUpdate(sequenceTcc);
+      forceUpdate(measureTcc);
+      if (staged.tupletBuffered)
+        forceUpdate(tupletTcc);
+      writeBeatTop(top);
+    } else {
+      applyCount(sequenceTcc, staged.countS, staged.upS);
+      applyCount(measureTcc, staged.countM, staged.upM);
+      if (staged.tupletBuffered)
+        applyCount(tupletTcc, staged.countT, staged.upT);
+
+      bool up = top >= beatTop;
+      if (up)
+        writeBeatTop(top);
+      beatTc->COUNT16.COUNT.reg = static_cast<uint16_t>(staged.countB);
+      if (!up)
+        writeBeatTop(top);
+    }
+    if (!staged.tupletBuffered)
+      applyTupletDirect(reset);
+
+    beatSwing = staged.beatSwing;
+    beatSecond = beatSecondNext;
+    tupletSwing = staged.tupletSwing;
+    if (beatSwing.first)
+      beatTc->COUNT16.INTENSET.reg = TC_INTENSET_OVF;
+    else
+      beatTc->COUNT16.INTENCLR.reg = TC_INTENCLR_OVF;
+    if (staged.beatWidth != lastBeatWidth)
+      beatTc->COUNT16.CC[1].reg = lastBeatWidth = staged.beatWidth;
+
+    activeMeasures = &inactiveMeasures();
+    measureIndex = reset ? 0 : staged.measureIndex;
+    writeMeasureCompare(activeMeasures->at[measureIndex]);
+
+    appliedTiming = stagedTiming;
+    tupletHeld = false;
+    periodsStaged = false;
+    isrPeriodsApplied(stagedTiming);
+  }
 }
 
 void writePeriods(const Timing& timing, divisor_t divisor) {
-  activeSequence = timing.sequence;
-  activeMeasure = timing.measure;
+  periodsStaged = false;    // superceded
+  tupletHeld = false;
+  setShift(quantumShift(timing));
+  appliedTiming = timing;
+  widthDivisor = divisor;
+  buildMeasureTable(*activeMeasures,
+    toCounter(timing.measure), toCounter(timing.sequence));
+
+  setSwingPair(beatSwing, timing.cycleB, timing.swungB, activeShift);
+  setSwingPair(tupletSwing, timing.cycleT, timing.swungT, activeShift);
+
+  releaseUpdates(sequenceTcc);
+  releaseUpdates(measureTcc);
+  releaseUpdates(tupletTcc);
 
   // sync as a group - though quantum is stopped, so shouldn't matter
-  sync(sequenceTcc, TCC_SYNCBUSY_PER | TCC_SYNCBUSY_CC0);
-  sync(measureTcc, TCC_SYNCBUSY_PER | TCC_SYNCBUSY_CC0);
-  sync(tupletTcc, TCC_SYNCBUSY_PER | TCC_SYNCBUSY_CC0);
+  sync(sequenceTcc, TCC_SYNCBUSY_PER | TCC_SYNCBUSY_PERB | TCC_SYNCBUSY_CC0);
+  sync(measureTcc, TCC_SYNCBUSY_PER | TCC_SYNCBUSY_PERB | TCC_SYNCBUSY_CC0);
+  sync(tupletTcc,
+    TCC_SYNCBUSY_PER | TCC_SYNCBUSY_PERB | TCC_SYNCBUSY_CC0 | TCC_SYNCBUSY_WAVE);
+
+  sequenceTcc->PER.reg = toCounter(timing.periodS) - 1;
+  sequenceTcc->PERB.reg = toCounter(timing.periodS) - 1;
+  measureTcc->PER.reg = toCounter(timing.periodM) - 1;
+  measureTcc->PERB.reg = toCounter(timing.periodM) - 1;
+    // so that no period preloaded by stagePeriods() is left to take effect
+
+  if (beatSwing.first) {
+    beatSecond = false;
+    writeBeatTop();
+    beatTc->COUNT16.INTENSET.reg = TC_INTENSET_OVF;
+  } else {
+    beatTc->COUNT16.INTENCLR.reg = TC_INTENCLR_OVF;
+    writeBeatTop(toCounter(timing.periodB) - 1);
+  }
 
-  sequenceTcc->PER.reg = timing.periodS - 1;
-  measureTcc->PER.reg = timing.periodM - 1;
-  beatTc->COUNT16.CC[0].reg = static_cast<uint16_t>(timing.periodB - 1);
-  tupletTcc->PER.reg = timing.periodT - 1;
+  tupletTcc->WAVE.reg
+    = TCC_WAVE_WAVEGEN_NPWM
+    | (tupletSwing.first ? TCC_WAVE_CIPEREN : 0);
+  if (tupletSwing.first) {
+    writeTupletPeriods(false);
+  } else {
+    tupletTcc->PER.reg = toCounter(timing.periodT) - 1;
+    tupletTcc->PERB.reg = toCounter(timing.periodT) - 1;
+      // so that no buffered period from swing is left to take effect
+  }
 
 
   q_t minQ = divisorToMinWidth(divisor);
 
-  sequenceTcc->CCB[0].reg   = max(minQ, timing.widthS) - 1;
-  measureTcc->CCB[0].reg    = max(minQ, timing.widthM) - 1;
+  sequenceTcc->CCB[0].reg   = widthRegister(minQ, timing.widthS, activeShift);
+  measureTcc->CCB[0].reg    = widthRegister(minQ, timing.widthM, activeShift);
   beatTc->COUNT16.CC[1].reg =
-    lastBeatWidth           = max(minQ, timing.widthB) - 1;
-  tupletTcc->CCB[0].reg     = max(minQ, timing.widthT) - 1;
+    lastBeatWidth           = widthRegister(minQ, timing.widthB, activeShift);
+  tupletTcc->CCB[0].reg     = widthRegister(minQ, timing.widthT, activeShift);
+}
+
+void stagePeriods(const Timing& timing, divisor_t divisor) {
+  periodsStaged = false;
+    // while the inactive measure table, and the buffers, are rewritten
+
+  uint8_t shift = activeShift;
+    // the same for both timings, see updateTiming() in clock.cpp
+  MeasureTable& table = inactiveMeasures();
+  buildMeasureTable(table,
+    toCounter(timing.measure, shift), toCounter(timing.sequence, shift));
+
+  // the buffers only transfer once the interrupt forces them
+  q_t minQ = divisorToMinWidth(divisor);
+  holdUpdates(sequenceTcc);
+  holdUpdates(measureTcc);
+  preload(sequenceTcc, toCounter(timing.periodS, shift),
+    widthRegister(minQ, timing.widthS, shift));
+  preload(measureTcc, toCounter(timing.periodM, shift),
+    widthRegister(minQ, timing.widthM, shift));
+
+  bool buffered = !timing.swungT && !appliedTiming.swungT;
+  if (buffered) {
+    holdUpdates(tupletTcc);
+    preload(tupletTcc, toCounter(timing.periodT, shift),
+      widthRegister(minQ, timing.widthT, shift));
+  } else if (tupletHeld) {
+    preload(tupletTcc, toCounter(appliedTiming.periodT),
+      widthRegister(minQ, appliedTiming.widthT, activeShift));
+    releaseUpdates(tupletTcc);
+  }
+  tupletHeld = buffered;
+
+  // The counts are for the boundary the measure compare is set for. Should
+  // the interrupt move it on meanwhile, they are worked out again.
+  for (bool done = false; !done; ) {
+    q_t boundary = measureCompare;
+    StagedWrites w;
+    stageWrites(timing, divisor, shift, fromCounter(boundary), table, w);
+
+    noInterrupts();
+    if (boundary == measureCompare) {
+      stagedTiming = timing;
+      staged = w;
+      periodsStaged = true;
+      done = true;
+    }
+    interrupts();
+  }
+}
+
+bool stagedPeriodsPending() {
+  return periodsStaged;
+}
+
+bool unstagePeriods() {
+  noInterrupts();
+  bool wasStaged = periodsStaged;
+  periodsStaged = false;
+  interrupts();
+
+  if (wasStaged)
+    restoreBuffers();
+  return wasStaged;
 }
 
 void updateWidths(divisor_t divisor, const Timing& timing) {
   q_t minQ = divisorToMinWidth(divisor);
+  widthDivisor = divisor;
 
   // TCC versions are buffered, changes on next cycle, don't need sync
   // TC version happens immediately, and will stall if sync'ing
 
-  sequenceTcc->CCB[0].reg   = max(minQ, timing.widthS) - 1;
-  measureTcc->CCB[0].reg    = max(minQ, timing.widthM) - 1;
+  noInterrupts();
+  if (periodsStaged) {
+    // the TCC buffers hold the staged widths until the boundary
+    uint8_t shift = activeShift;
+    sequenceTcc->CCB[0].reg = widthRegister(minQ, stagedTiming.widthS, shift);
+    measureTcc->CCB[0].reg  = widthRegister(minQ, stagedTiming.widthM, shift);
+    staged.beatWidth        = widthRegister(minQ, stagedTiming.widthB, shift);
+    staged.tupletWidth      = widthRegister(minQ, stagedTiming.widthT, shift);
+    tupletTcc->CCB[0].reg = tupletHeld
+      ? staged.tupletWidth
+      : widthRegister(minQ, timing.widthT, activeShift);
+  } else {
+    sequenceTcc->CCB[0].reg = widthRegister(minQ, timing.widthS, activeShift);
+    measureTcc->CCB[0].reg  = widthRegister(minQ, timing.widthM, activeShift);
+    tupletTcc->CCB[0].reg   = widthRegister(minQ, timing.widthT, activeShift);
+  }
+  interrupts();
 
-  q_t beatWidth = max(minQ, timing.widthB) - 1;
+  q_t beatWidth = widthRegister(minQ, timing.widthB, activeShift);
   if (beatWidth != lastBeatWidth) {
       // avoid writing (and stalling for sync) if not changed
       beatTc->COUNT16.CC[1].reg = lastBeatWidth = beatWidth;
   }
-
-  tupletTcc->CCB[0].reg     = max(minQ, timing.widthT) - 1;
 }
 
-
 namespace {
 
   void initializePins() {
@@ -376,7 +914,7 @@ namespace {
     forceTriggersOff(true);
 
     TriggerInput::C.initialize();
-    TriggerInput::O.initialize();   // though otherwise unused
+    TriggerInput::O.initialize();
   }
 }
 
@@ -390,9 +928,9 @@ void forceTriggersOff(bool off) {
 
 q_t resetWatchdog(q_t interval)
 {
-    q_t resetCount = constrain(0x10000 - interval, 0, 0xffff);
+    q_t resetCount = constrain(0x10000 - widthToCounter(interval), 0, 0xffff);
     watchdogTc->COUNT16.COUNT.reg = (uint16_t)(resetCount);
-    return resetCount;
+    return fromCounter(resetCount);
 }
 
 
@@ -433,9 +971,12 @@ void initializeTimers() {
   EIC->CTRL.reg = EIC_CTRL_SWRST;
   while (EIC->STATUS.bit.SYNCBUSY);
   EIC->EVCTRL.reg
-    |= EIC_EVCTRL_EXTINTEO8;
+    |= EIC_EVCTRL_EXTINTEO8
+    | EIC_EVCTRL_EXTINTEO9;
   EIC->CONFIG[1].bit.FILTEN0 = 1;
   EIC->CONFIG[1].bit.SENSE0 = EIC_CONFIG_SENSE0_FALL_Val;
+  EIC->CONFIG[1].bit.FILTEN1 = 1;
+  EIC->CONFIG[1].bit.SENSE1 = EIC_CONFIG_SENSE1_FALL_Val;
     // input buffer circuit inverts the signal
   EIC->CTRL.reg = EIC_CTRL_ENABLE;
   while (EIC->STATUS.bit.SYNCBUSY);
@@ -507,6 +1048,14 @@ void initializeTimers() {
     ;
 
   enable(beatTc);
+  NVIC_SetPriority(TC5_IRQn, 0);
+  NVIC_EnableIRQ(TC5_IRQn);
+    // The overflow interrupt is only enabled for swing. It shares priority
+    // with TCC0, as the capture and measure interrupts also set beatSecond
+    // and the top: if either could preempt it, it would go on to write the
+    // top of the old pair. It is a flip and a register write, a few dozen
+    // cycles, see the TC5 stats in dumpTimers(), once per B pulse, so it
+    // delays TCC0 far less than the quantum those have to write counts.
 
   initializeTcc(measureTcc);
 
@@ -520,11 +1069,17 @@ void initializeTimers() {
 }
 
 
+namespace {
+  IsrStats sequenceIsrStats;
+  IsrStats watchdogIsrStats;
+  IsrStats beatIsrStats;
+}
+
 void dumpTimers() {
   Offsets counts;
 
-  Serial.printf("quantum events %s\n",
-    quantumRunning ? "running" : "stopped");
+  Serial.printf("quantum events %s, each %dQ\n",
+    quantumRunning ? "running" : "stopped", 1 << activeShift);
 
   {
     PauseQuantum pq;
@@ -535,37 +1090,68 @@ void dumpTimers() {
 
   uint16_t watchCount = watchdogTc->COUNT16.COUNT.reg;
   Serial.printf("watchdogTimer count: %d\n", watchCount);
+
+  noInterrupts();
+  IsrStats seqStats = sequenceIsrStats;
+  IsrStats watchStats = watchdogIsrStats;
+  IsrStats beatStats = beatIsrStats;
+  sequenceIsrStats.zero();
+  watchdogIsrStats.zero();
+  beatIsrStats.zero();
+  interrupts();
+
+  seqStats.dump("TCC0 (sequence)");
+  watchStats.dump("TC3 (watchdog)");
+  beatStats.dump("TC5 (beat swing)");
 }
 
 
 
 
 void TCC0_Handler() {
+  IsrTiming timing(sequenceIsrStats);
+
   auto intflag = TCC0->INTFLAG.reg;
+  if (intflag & TCC_INTFLAG_TRG) {
+    // The reset input has retriggered the TCC units, in hardware. The beat
+    // timer's only event input counts quanta, so it is retriggered here.
+    beatTc->COUNT16.CTRLBSET.reg = TC_CTRLBSET_CMD_RETRIGGER;
+
+    if (periodsStaged) {
+      applyStagedPeriods(true);
+    } else {
+      writeMeasureCompare(stepMeasure(true));
+      restartSwing();
+    }
+
+    isrReset();
+    isrMeasure();
+    TCC0->INTFLAG.reg = TCC_INTFLAG_TRG | TCC_INTFLAG_OVF | TCC_INTFLAG_MC2;
+    intflag &= ~(TCC_INTFLAG_OVF | TCC_INTFLAG_MC2);
+      // the measure compare is already taken care of
+  }
   if (intflag & TCC_INTFLAG_MC1) {
     sync(sequenceTcc, TCC_SYNCBUSY_CC1);
     auto sequenceCapture = sequenceTcc->CC[1].reg;
     auto watchdogCapture = watchdogTc->COUNT16.COUNT.reg;
-    isrClockCapture(sequenceCapture, watchdogCapture);
+    isrClockCapture(fromCounter(sequenceCapture), fromCounter(watchdogCapture));
     TCC0->INTFLAG.reg = TCC_INTFLAG_MC1;    // writing 1 clears the flag
   }
   if (intflag & (TCC_INTFLAG_OVF | TCC_INTFLAG_MC2)) {
-    sync(sequenceTcc, TCC_SYNCBUSY_CTRLB);
-    sequenceTcc->CTRLBSET.reg = TCC_CTRLBSET_CMD_READSYNC;
-    while (sequenceTcc->CTRLBSET.bit.CMD);
-    sync(sequenceTcc, TCC_SYNCBUSY_COUNT); // redudant with the above?
-    auto s = sequenceTcc->COUNT.reg;
-
-    auto m = nextMeasure(s);
-    sync(sequenceTcc, TCC_SYNCBUSY_CC2);
-    sequenceTcc->CC[2].reg = m;
+    if (periodsStaged)
+      applyStagedPeriods(false);  // also sets the next measure compare
+    else
+      writeMeasureCompare(stepMeasure(intflag & TCC_INTFLAG_OVF));
 
     isrMeasure();
   }
-  TCC0->INTFLAG.reg = TCC_INTFLAG_OVF | TCC_INTFLAG_MC1 | TCC_INTFLAG_MC2;
+  TCC0->INTFLAG.reg
+    = TCC_INTFLAG_OVF | TCC_INTFLAG_TRG | TCC_INTFLAG_MC1 | TCC_INTFLAG_MC2;
 }
 
 void TC3_Handler() {
+  IsrTiming timing(watchdogIsrStats);
+
   if (TC3->COUNT16.INTFLAG.reg & TC_INTFLAG_OVF) {
     isrWatchdog();
     TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;   // writing 1 clears the flag
@@ -573,4 +1159,13 @@ void TC3_Handler() {
 }
 
 
+void TC5_Handler() {
+  IsrTiming timing(beatIsrStats);
+
+  if (TC5->COUNT16.INTFLAG.reg & TC_INTFLAG_OVF) {
+    beatSecond = !beatSecond;
+    writeBeatTop();     // also clears the flag
+  }
+}
+
 #endif // __SAMD21__
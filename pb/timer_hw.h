@@ -3,16 +3,31 @@
 
 #include "timing.h"
 
+/*
+  The timer backend: the quantum, watchdog, beat, sequence, measure and
+  tuplet counters, and the routing of the clock and reset inputs to them.
+
+  On the SAMD21, this is implemented on the TC and TCC units, along with the
+  event system, in timer_hw.cpp. Elsewhere, timer_sim.cpp implements it as
+  a simulation in virtual time, see timer_sim.h.
+*/
+
 void initializeTimers();
 
 extern void isrMeasure();
 extern void isrClockCapture(q_t, q_t);
 extern void isrWatchdog();
+extern void isrReset();     // the counts were zeroed by the reset input
+extern void isrPeriodsApplied(const Timing&);   // see stagePeriods()
 
 
 typedef uint16_t divisor_t;     // the quantum timer has a 16 bit counter
-float divisorToBpm(divisor_t);
-divisor_t divisorFromBpm(float);
+bpm100_t divisorToBpm100(divisor_t);
+divisor_t divisorFromBpm100(bpm100_t);
+divisor_t divisorFromBeatMicros(uint32_t);
+
+q_t divisorToMinWidth(divisor_t);
+  // the shortest trigger, in Q, that is still long enough to be seen
 
 void setQuantumDivisor(divisor_t);
 void startQuantumEvents();
@@ -31,12 +46,29 @@ void readCounts(Offsets&);
 void writeCounts(const Offsets&);
 void zeroCounts();
 void writePeriods(const Timing&, divisor_t);
+void stagePeriods(const Timing&, divisor_t);
+  // the periods are written, and counts adjusted, at the next measure
+  // boundary, without stopping the quantum: the counts for it are worked
+  // out here, so the measure interrupt only has to write them
+  // The timing must have the quantum shift of the one on the counters.
+bool stagedPeriodsPending();
+bool unstagePeriods();
+  // drops the staged periods, false if they had already been applied
 void updateWidths(divisor_t, const Timing&);
 
 void forceTriggersOff(bool);
 
 q_t resetWatchdog(q_t);
 
+enum ExtClkSource {
+  extClkInput,        // the clock input jack
+  extClkSoftware,     // softwareExtClk(), such as from MIDI
+};
+
+void setExtClkSource(ExtClkSource);
+void softwareExtClk();
+  // the capture happens as if the clock input had a rising edge right now
+
 
 void dumpTimers();
 
@@ -0,0 +1,456 @@
+#include "timer_hw.h"
+#include "timer_sim.h"
+
+#include <Arduino.h>
+
+#include "isr_stats.h"
+
+
+// *** NOTE: This implementation is for everything but the SAMD21.
+#if !(defined(__SAMD21__) || defined(TC4) || defined(TC5))
+
+/*
+  This follows timer_hw.cpp, but with simplifications:
+    - Writes take effect immediately, there is no register sync.
+    - The widths, which are buffered on the TCC units, change immediately.
+    - Interrupts happen in zero virtual time, as do the reads and writes
+      they make. But for the interrupt statistics, the cycles the SAMD21
+      would spend on them are tallied from rough costs, see spend().
+      Counts written by an interrupt are late by the cycles it has spent
+      so far: any quantum that came by then is lost, as on the SAMD21.
+    - Swung counters run over the whole pair of periods, rather than
+      swapping periods each time.
+*/
+
+namespace {
+  struct SimCounter {
+    q_t   period;     // the whole cycle, when swung
+    q_t   count;
+    q_t   width;      // the trigger is on while count < width
+    q_t   swung;      // if swung, the second period of the pair starts here
+    bool  on;
+  };
+
+  SimCounter counters[4];   // indexed by SimOutput
+
+  uint64_t  now = 0;
+  uint64_t  nextQuantumAt = 0;
+  divisor_t quantumDivisor = 1;
+  bool      quantumRunning = false;
+  bool      triggersOff = true;
+
+  uint16_t  watchdogCount = 0;
+  q_t       measureCompare = 0;
+
+  q_t activeSequence;
+  q_t activeMeasure;
+
+  Timing    stagedTiming;
+  divisor_t stagedDivisor;
+  Offsets   stagedCounts;     // at the boundary the measure compare is for
+  bool      periodsStaged = false;
+
+  bool      inIsr = false;
+  uint32_t  isrStartedAt = 0;   // in isrSimulatedCycles
+  uint32_t  quantaLost = 0;     // the counters miss this many quanta
+
+  ExtClkSource extClkSource = extClkInput;
+
+  SimEdgeHandler edgeHandler = nullptr;
+
+  IsrStats  sequenceIsrStats;
+  IsrStats  watchdogIsrStats;
+  IsrStats  measureIsrStats;
+  bool      measureReadback = false;
+
+  // Rough costs, in CPU cycles, of what timer_hw.cpp does on the SAMD21.
+  // The register writes wait for the peripheral clock domain to sync. The
+  // clock code is costed per call, at about what the estimator takes with
+  // the 64 bit multiplies done in software.
+  const uint32_t costIsr = 40;          // entry, exit, and the statistics
+  const uint32_t costRegister = 6;      // a read or write on the bus
+  const uint32_t costSync = 30;         // waiting for a write to sync
+  const uint32_t costCapture = 600;     // isrClockCapture()
+  const uint32_t costWatchdog = 100;    // isrWatchdog()
+  const uint32_t costHook = 60;         // the others
+  const uint32_t costDivide = 80;       // in software, the M0 has no divide
+  const uint32_t costStep = 10;         // stepping through the measure table
+
+  inline void spend(uint32_t cycles) {
+    isrSimulatedCycles += cycles;
+  }
+
+  inline void spendWrites(int n) {
+    spend(n * (costRegister + costSync));
+  }
+
+  inline q_t nextMeasure(q_t currSequence) {
+    return measureAfter(currSequence, activeMeasure, activeSequence);
+  }
+
+  void updateOutput(SimOutput output) {
+    SimCounter& c = counters[output];
+    bool on = !triggersOff
+      && (c.count < c.width
+        || (c.swung && c.count >= c.swung && c.count - c.swung < c.width));
+    if (on == c.on)
+      return;
+
+    c.on = on;
+    if (edgeHandler) {
+      SimEdge edge = { now, output, on };
+      edgeHandler(edge);
+    }
+  }
+
+  void updateOutputs() {
+    updateOutput(simOutputS);
+    updateOutput(simOutputM);
+    updateOutput(simOutputB);
+    updateOutput(simOutputT);
+  }
+
+  // The cycle count only moves within interrupts, so the statistics see
+  // just the costs. Another interrupt is pending if it came from the same
+  // quantum.
+  struct SimIsr {
+    SimIsr(bool another = false) {
+      isrSimulatedPending = another;
+      inIsr = true;
+      isrStartedAt = isrSimulatedCycles;
+    }
+    ~SimIsr() { inIsr = false; }
+  };
+
+  void losePassedQuanta() {
+    // the interrupt started with no time passing, so the quanta that came
+    // while it ran up to now are those since now
+    if (!inIsr || !quantumRunning)
+      return;
+    uint64_t elapsed = isrSimulatedCycles - isrStartedAt;
+    uint64_t next = nextQuantumAt - now;
+    if (elapsed >= next)
+      quantaLost += (uint32_t)(1 + (elapsed - next) / quantumDivisor);
+  }
+
+  void setPeriods(const Timing& timing) {
+    activeSequence = timing.sequence;
+    activeMeasure = timing.measure;
+
+    counters[simOutputS].period = timing.periodS;
+    counters[simOutputM].period = timing.periodM;
+    counters[simOutputB].period = timing.cycleB;
+    counters[simOutputT].period = timing.cycleT;
+
+    counters[simOutputS].swung = 0;
+    counters[simOutputM].swung = 0;
+    counters[simOutputB].swung = timing.swungB;
+    counters[simOutputT].swung = timing.swungT;
+  }
+
+  void applyStagedPeriods(bool reset) {
+    // as timer_hw.cpp does, with the counts worked out by stagePeriods(),
+    // and the periods in the buffers
+    spendWrites(3);       // forcing the TCC updates
+    if (!reset) {
+      spendWrites(4);
+      losePassedQuanta();
+      counters[simOutputS].count = stagedCounts.countS;
+      counters[simOutputM].count = stagedCounts.countM;
+      counters[simOutputB].count = stagedCounts.countB;
+      counters[simOutputT].count = stagedCounts.countT;
+    }
+    spendWrites(2);       // the beat's period and width
+
+    periodsStaged = false;
+    setPeriods(stagedTiming);
+    updateWidths(stagedDivisor, stagedTiming);
+
+    measureCompare = nextMeasure(counters[simOutputS].count);
+    spend(costStep);
+    spendWrites(1);
+    spend(costHook);
+    isrPeriodsApplied(stagedTiming);
+  }
+
+  void sequenceMeasureIsr() {
+    SimIsr isr;
+    IsrTiming timing(sequenceIsrStats);
+    spend(costIsr);
+
+    IsrTiming measureTiming(measureIsrStats);
+
+    auto s = counters[simOutputS].count;
+    if (measureReadback)
+      spend(2 * (costRegister + costSync));
+        // a READSYNC command, and the wait for it, then reading the count
+    if (periodsStaged)
+      applyStagedPeriods(false);
+    else {
+      measureCompare = nextMeasure(s);
+      spend(measureReadback ? costDivide : costStep);
+      spendWrites(1);
+    }
+
+    spend(costHook);
+    isrMeasure();
+  }
+
+  void sequenceCaptureIsr() {
+    SimIsr isr;
+    IsrTiming timing(sequenceIsrStats);
+    spend(costIsr);
+
+    spend(costSync + 2 * costRegister);   // reading the captures
+    spend(costCapture);
+    isrClockCapture(counters[simOutputS].count, watchdogCount);
+  }
+
+  void watchdogIsr(bool another) {
+    SimIsr isr(another);
+    IsrTiming timing(watchdogIsrStats);
+    spend(costIsr);
+
+    spend(costWatchdog);
+    isrWatchdog();
+  }
+
+  void quantum() {
+    // On the SAMD21, the quantum event reaches all the counters at once,
+    // and the interrupts follow. The watchdog's goes first.
+    watchdogCount += 1;
+    bool watchdogDue = watchdogCount == 0;
+    bool measureDue = false;
+
+    if (quantumRunning && quantaLost > 0)
+      quantaLost -= 1;
+    else if (quantumRunning) {
+      for (auto& c : counters)
+        c.count = (c.count + 1 < c.period) ? c.count + 1 : 0;
+      updateOutputs();
+
+      auto s = counters[simOutputS].count;
+      measureDue = s == 0 || s == measureCompare;
+    }
+
+    if (watchdogDue)
+      watchdogIsr(measureDue);
+    if (measureDue)
+      sequenceMeasureIsr();
+  }
+}
+
+
+uint64_t simNow() {
+  return now;
+}
+
+void simAdvance(uint64_t ticks) {
+  uint64_t until = now + ticks;
+  while (nextQuantumAt <= until) {
+    now = nextQuantumAt;
+    nextQuantumAt += quantumDivisor;
+    quantum();
+  }
+  now = until;
+}
+
+void simExtClk() {
+  if (extClkSource == extClkInput)
+    sequenceCaptureIsr();
+}
+
+void simReset() {
+  counters[simOutputS].count = 0;
+  counters[simOutputM].count = 0;
+  counters[simOutputB].count = 0;
+  counters[simOutputT].count = 0;
+  updateOutputs();
+
+  SimIsr isr;
+  IsrTiming timing(sequenceIsrStats);
+  spend(costIsr);
+
+  if (periodsStaged)
+    applyStagedPeriods(true);
+  else {
+    measureCompare = nextMeasure(0);
+    spendWrites(1);
+  }
+
+  spend(2 * costHook);
+  isrReset();
+  isrMeasure();
+}
+
+divisor_t simQuantumDivisor() {
+  return quantumDivisor;
+}
+
+void simOnEdge(SimEdgeHandler handler) {
+  edgeHandler = handler;
+}
+
+const IsrStats& simSequenceIsrStats() {
+  return sequenceIsrStats;
+}
+
+const IsrStats& simWatchdogIsrStats() {
+  return watchdogIsrStats;
+}
+
+const IsrStats& simMeasureIsrStats() {
+  return measureIsrStats;
+}
+
+void simMeasureReadback(bool readback) {
+  measureReadback = readback;
+}
+
+
+void setQuantumDivisor(divisor_t d) {
+  // like TC4, the quantum in progress completes at the old rate
+  quantumDivisor = d ? d : 1;
+  spendWrites(1);
+}
+
+void startQuantumEvents() {
+  quantumRunning = true;
+}
+
+void stopQuantumEvents() {
+  quantumRunning = false;
+}
+
+PauseQuantum::PauseQuantum()
+  : wasRunning(quantumRunning)
+  { if (wasRunning) stopQuantumEvents(); }
+
+PauseQuantum::~PauseQuantum()
+  { if (wasRunning) startQuantumEvents(); }
+
+
+void readCounts(Offsets& counts) {
+  spendWrites(4);     // each needs a READSYNC command
+  counts.countS = counters[simOutputS].count;
+  counts.countM = counters[simOutputM].count;
+  counts.countB = counters[simOutputB].count;
+  counts.countT = counters[simOutputT].count;
+}
+
+void writeCounts(const Offsets& counts) {
+  spendWrites(5);
+  losePassedQuanta();
+  counters[simOutputS].count = counts.countS;
+  counters[simOutputM].count = counts.countM;
+  counters[simOutputB].count = counts.countB;
+  counters[simOutputT].count = counts.countT;
+  updateOutputs();
+
+  measureCompare = nextMeasure(counts.countS);
+}
+
+void zeroCounts() {
+  Offsets zeros = { 0, 0, 0, 0 };
+  writeCounts(zeros);
+}
+
+void writePeriods(const Timing& timing, divisor_t divisor) {
+  periodsStaged = false;    // superceded
+  spendWrites(4);
+  setPeriods(timing);
+  updateWidths(divisor, timing);
+}
+
+void stagePeriods(const Timing& timing, divisor_t divisor) {
+  // as timer_hw.cpp does, in loop(), for the boundary the measure compare
+  // is set for
+  stagedTiming = timing;
+  stagedDivisor = divisor;
+  stagedCounts.countS = measureCompare;
+  adjustOffsets(timing, stagedCounts);
+  periodsStaged = true;
+}
+
+bool stagedPeriodsPending() {
+  return periodsStaged;
+}
+
+bool unstagePeriods() {
+  bool wasStaged = periodsStaged;
+  periodsStaged = false;
+  return wasStaged;
+}
+
+void updateWidths(divisor_t divisor, const Timing& timing) {
+  q_t minQ = divisorToMinWidth(divisor);
+  spendWrites(4);
+
+  counters[simOutputS].width = max(minQ, timing.widthS);
+  counters[simOutputM].width = max(minQ, timing.widthM);
+  counters[simOutputB].width = max(minQ, timing.widthB);
+  counters[simOutputT].width = max(minQ, timing.widthT);
+  updateOutputs();
+}
+
+void forceTriggersOff(bool off) {
+  triggersOff = off;
+  spendWrites(4);
+  updateOutputs();
+}
+
+q_t resetWatchdog(q_t interval) {
+  q_t resetCount = constrain(0x10000 - interval, 0, 0xffff);
+  watchdogCount = (uint16_t)resetCount;
+  spendWrites(1);
+  return resetCount;
+}
+
+void setExtClkSource(ExtClkSource source) {
+  extClkSource = source;
+}
+
+void softwareExtClk() {
+  if (extClkSource == extClkSoftware)
+    sequenceCaptureIsr();
+}
+
+
+void initializeTimers() {
+  now = 0;
+  nextQuantumAt = quantumDivisor;
+  quantumRunning = false;
+  triggersOff = true;
+  watchdogCount = 0;
+  periodsStaged = false;
+  quantaLost = 0;
+
+  sequenceIsrStats.zero();
+  watchdogIsrStats.zero();
+  measureIsrStats.zero();
+  measureReadback = false;
+
+  for (auto& c : counters)
+    c = SimCounter{ 1, 0, 0, 0, false };
+}
+
+
+void dumpTimers() {
+  Offsets counts;
+
+  Serial.printf("quantum events %s\n",
+    quantumRunning ? "running" : "stopped");
+
+  readCounts(counts);
+  dumpOffsets(counts);
+
+  Serial.printf("watchdogTimer count: %d\n", watchdogCount);
+
+  sequenceIsrStats.dump("TCC0 (sequence)");
+  watchdogIsrStats.dump("TC3 (watchdog)");
+  sequenceIsrStats.zero();
+  watchdogIsrStats.zero();
+  measureIsrStats.zero();
+}
+
+#endif // !__SAMD21__
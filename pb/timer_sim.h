@@ -0,0 +1,62 @@
+#ifndef _INCLUDE_TIMER_SIM_H_
+#define _INCLUDE_TIMER_SIM_H_
+
+#include <stdint.h>
+
+#include "isr_stats.h"
+#include "timer_hw.h"
+
+/*
+  Simulation of the timer backend, for running the clock and timing code off
+  the hardware, such as on a Linux box.
+
+  Time is virtual, in CPU ticks, and only moves with simAdvance(). The
+  quantum timer ticks every divisor CPU ticks, and drives the counters just
+  as the event system does on the SAMD21. The interrupt service routines
+  are called from within simAdvance(), simExtClk() and simReset(), and run
+  in zero time, though their statistics tally the cycles they would take.
+
+  The trigger outputs are reported as edges, as they change.
+*/
+
+#if !(defined(__SAMD21__) || defined(TC4) || defined(TC5))
+
+uint64_t simNow();
+void simAdvance(uint64_t ticks);
+
+void simExtClk();       // a rising edge on the clock input, now
+void simReset();        // a rising edge on the reset input, now
+
+divisor_t simQuantumDivisor();    // as last set by setQuantumDivisor()
+
+enum SimOutput : uint8_t {
+  simOutputS,
+  simOutputM,
+  simOutputB,
+  simOutputT,
+};
+
+struct SimEdge {
+  uint64_t  at;         // CPU ticks
+  SimOutput output;
+  bool      rising;     // the trigger starts
+};
+
+typedef void (*SimEdgeHandler)(const SimEdge&);
+void simOnEdge(SimEdgeHandler);
+
+const IsrStats& simSequenceIsrStats();
+const IsrStats& simWatchdogIsrStats();
+  // zeroed by initializeTimers() and dumpTimers()
+
+const IsrStats& simMeasureIsrStats();
+  // just the measure interrupts, which the sequence statistics include
+
+void simMeasureReadback(bool);
+  // costs the measure interrupt as it was before the position was kept in
+  // a shadow: reading the count with READSYNC, then dividing it
+  // Off by default, and after initializeTimers().
+
+#endif
+
+#endif // _INCLUDE_TIMER_SIM_H_
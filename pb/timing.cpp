@@ -8,28 +8,192 @@
 
 namespace {
 
-  q_t qPerBeatUnit(uint16_t b) {
+  // The ranges of the settings, as offered in layout.cpp and ui_music.cpp.
+  // Everything computed below is checked against these, at compile time.
+  const q_t maxBeatsPerMeasure = 16;
+  const q_t maxBeatUnitQ = Q_PER_B * 2;     // half note
+  const q_t maxTupletUnitQ = Q_PER_B;       // quarter note
+  const q_t minTupletUnitQ = Q_PER_B / 4;   // sixteenth note
+  const q_t maxTupletTime = 8;
+  const q_t minTupletCount = 2;
+  const q_t maxTupletCount = 9;
+
+  const q_t maxTCCPeriod = 1ul << 24;   // the TCC units have 24 bit counters
+  const q_t maxTCPeriod = 1ul << 16;    // the beat TC has a 16 bit counter
+
+  static_assert(
+    maxNumberMeasures * maxBeatsPerMeasure * maxBeatUnitQ <= maxTCCPeriod,
+    "longest sequence doesn't fit the sequence TCC");
+  static_assert(maxTupletUnitQ <= maxTCPeriod,
+    "longest beat doesn't fit the beat TC");
+  static_assert(maxTupletTime * maxTupletUnitQ / minTupletCount <= maxTCPeriod,
+    "longest tuplet doesn't fit the beat TC, which it can be routed to");
+  static_assert(maxTupletTime * maxTupletUnitQ / minTupletCount <= maxTCCPeriod,
+    "longest tuplet doesn't fit the tuplet TCC");
+
+  int beatUnitShift(uint16_t b) {
     switch (b) {
-      case  1: return Q_PER_B * 4;  // whole note
-      case  2: return Q_PER_B * 2;  // half note
-      case  4: return Q_PER_B;      // quarter note
-      case  8: return Q_PER_B / 2;  // eighth note
-      case 16: return Q_PER_B / 4;  // sixteenth note
+      case  1: return 0;    // whole note
+      case  2: return 1;    // half note
+      case  4: return 2;    // quarter note
+      case  8: return 3;    // eighth note
+      case 16: return 4;    // sixteenth note
     }
 
     // should never happen!
     critical.printf("Unsupported beat unit: %d\n", b);
+    return 2;
+  }
+
+  inline q_t qPerBeatUnit(uint16_t b) {
+    return (Q_PER_B * 4) >> beatUnitShift(b);
+  }
+
+  q_t qPerFixedNote(uint8_t n) {
+    switch (n) {
+      case  4: return Q_PER_B;
+      case  8: return Q_PER_B / 2;
+      case 16: return Q_PER_B / 4;
+      case 32: return Q_PER_B / 8;
+    }
+
+    // should never happen!
+    critical.printf("Unsupported note value: %d\n", n);
     return Q_PER_B;
   }
 
+  // Q per tuplet division, for each beat unit and tuplet count, so that
+  // computing the tuplet period doesn't need a divide. Since Q is 1/4 of
+  // the LCM of 1..9, the smallest tuplet unit always divides evenly.
+
+  constexpr bool dividesEvenly(q_t q, q_t count = maxTupletCount) {
+    return count < minTupletCount
+      || (q % count == 0 && dividesEvenly(q, count - 1));
+  }
+
+  static_assert(dividesEvenly(minTupletUnitQ),
+    "smallest tuplet unit doesn't divide evenly into tuplets");
+
+#define TUPLET_ROW(shift) \
+  { (Q_PER_B * 4) >> shift, (Q_PER_B * 4) >> shift, \
+    ((Q_PER_B * 4) >> shift) / 2, ((Q_PER_B * 4) >> shift) / 3, \
+    ((Q_PER_B * 4) >> shift) / 4, ((Q_PER_B * 4) >> shift) / 5, \
+    ((Q_PER_B * 4) >> shift) / 6, ((Q_PER_B * 4) >> shift) / 7, \
+    ((Q_PER_B * 4) >> shift) / 8, ((Q_PER_B * 4) >> shift) / 9 }
+
+  const q_t qPerTupletDivision[5][maxTupletCount + 1] = {
+    TUPLET_ROW(0), TUPLET_ROW(1), TUPLET_ROW(2), TUPLET_ROW(3), TUPLET_ROW(4)
+  };
+
+#undef TUPLET_ROW
+
+  q_t qPerTuplet(uint16_t unit, uint8_t count) {
+    if (count > maxTupletCount) {
+      // should never happen!
+      critical.printf("Unsupported tuplet count: %d\n", count);
+      count = 1;
+    }
+    return qPerTupletDivision[beatUnitShift(unit)][count];
+  }
+
+  q_t qForOutput(OutputMode m,
+      q_t sequence, q_t measure, q_t beat, q_t tuplet) {
+    if (m & outputFixedFlag)
+      return qPerFixedNote(m & outputNoteMask);
+
+    switch (m) {
+      case outputSequence:  return sequence;
+      case outputMeasure:   return measure;
+      case outputBeat:      return beat;
+      case otuputTuplet:    return tuplet;
+      default:              break;
+    }
+
+    // should never happen!
+    critical.printf("Unsupported output mode: %d\n", m);
+    return beat;
+  }
+
+  inline q_t divideBy3(q_t x) {
+    // exact for all 32 bit x, and cheaper than a soft divide
+    return static_cast<q_t>((uint64_t(x) * 0xaaaaaaabull) >> 33);
+  }
+
+  bool factorDivides(OutputFactor f, q_t period) {
+    // slower rates multiply the period, so are always exact
+    switch (f) {
+      case  2: return (period & 1) == 0;
+      case  3: return divideBy3(period) * 3 == period;
+      case  4: return (period & 3) == 0;
+      case  6: return (period & 1) == 0 && divideBy3(period) * 3 == period;
+      case  8: return (period & 7) == 0;
+      default: return true;
+    }
+  }
+
+  q_t applyFactor(OutputFactor f, q_t period) {
+    // exact, as the UI only offers factors that divide the period, see
+    // outputsFit(), otherwise rounded down
+    switch (f) {
+      case outputFactorNone:
+      case  1:
+      case -1: return period;
+
+      case  2: return period >> 1;
+      case  3: return divideBy3(period);
+      case  4: return period >> 2;
+      case  6: return divideBy3(period) >> 1;
+      case  8: return period >> 3;
+    }
+
+    if (f < 0)
+      return period * qcast(-f);
+
+    // should never happen!
+    critical.printf("Unsupported output factor: %d\n", f);
+    return period;
+  }
+
+  constexpr uint32_t percentQ16(uint32_t p) { return (p * 65536 + 50) / 100; }
+
+  uint32_t swingQ16(uint8_t swing) {
+    // the first period's share of a swung pair, or zero if not swung
+    switch (swing) {
+      case swingNone:
+      case 50: return 0;
+
+      case 54: return percentQ16(54);
+      case 58: return percentQ16(58);
+      case 62: return percentQ16(62);
+      case 66: return percentQ16(66);
+      case 71: return percentQ16(71);
+      case 75: return percentQ16(75);
+    }
+
+    // should never happen!
+    critical.printf("Unsupported swing: %d\n", swing);
+    return 0;
+  }
+
+  void swingPeriods(uint32_t swing16, q_t period, q_t& cycle, q_t& swung) {
+    cycle = 2 * period;
+    swung = static_cast<q_t>((uint64_t(cycle) * swing16) >> 16);
+
+    if (swung <= period) {
+      // not swung, or too short to be
+      cycle = period;
+      swung = 0;
+    }
+  }
+
   q_t qForWidth(PulseWidth pt, q_t period) {
     switch (pt) {
       case pulseFixedShort:   return 0;
-      case pulseDutyHalf:     return period / 2;
-      case pulseDutyThird:    return period / 3;
-      case pulseDutyQuarter:  return period / 4;
-      case pulseDuration16:   return min(Q_PER_B, period) / 4;
-      case pulseDuration32:   return min(Q_PER_B, period) / 8;
+      case pulseDutyHalf:     return period >> 1;
+      case pulseDutyThird:    return divideBy3(period);
+      case pulseDutyQuarter:  return period >> 2;
+      case pulseDuration16:   return min(Q_PER_B, period) >> 2;
+      case pulseDuration32:   return min(Q_PER_B, period) >> 3;
     }
 
     // should never happen!
@@ -51,6 +215,7 @@ void dumpQ(q_t q){
 void dumpTiming(const Timing& t) {
   Serial.print("  sequence = "); dumpQ(t.sequence);  Serial.println();
   Serial.print("  measure  = "); dumpQ(t.measure);   Serial.println();
+  Serial.print("  beatUnit = "); dumpQ(t.beatUnit);  Serial.println();
   Serial.println();
   Serial.print("  periodS  = "); dumpQ(t.periodS);   Serial.println();
   Serial.print("  periodM  = "); dumpQ(t.periodM);   Serial.println();
@@ -61,6 +226,11 @@ void dumpTiming(const Timing& t) {
   Serial.print("  widthM   = "); dumpQ(t.widthM);    Serial.println();
   Serial.print("  widthB   = "); dumpQ(t.widthB);    Serial.println();
   Serial.print("  widthT   = "); dumpQ(t.widthT);    Serial.println();
+  Serial.println();
+  Serial.print("  cycleB   = "); dumpQ(t.cycleB);    Serial.println();
+  Serial.print("  cycleT   = "); dumpQ(t.cycleT);    Serial.println();
+  Serial.print("  swungB   = "); dumpQ(t.swungB);    Serial.println();
+  Serial.print("  swungT   = "); dumpQ(t.swungT);    Serial.println();
 }
 
 void dumpOffsets(const Offsets& t) {
@@ -71,26 +241,79 @@ void dumpOffsets(const Offsets& t) {
 }
 
 
-void computePeriods(const State& s, Timing& t) {
-  const Settings& u = s.settings;
+namespace {
+  // the periods the outputs can be routed from
+  struct Sources {
+    q_t sequence;
+    q_t measure;
+    q_t beat;
+    q_t tuplet;
 
-  auto measure  = qcast(u.beatsPerMeasure) * qPerBeatUnit(u.beatUnit);
-  auto sequence = qcast(u.numberMeasures) * measure;
-  auto beat     = qPerBeatUnit(u.tupletUnit);
-  auto tuplet   = qcast(u.tupletTime) * beat / qcast(u.tupletCount);
+    Sources(const Settings& u)
+      : measure(qcast(u.beatsPerMeasure) * qPerBeatUnit(u.beatUnit)),
+        beat(qPerBeatUnit(u.tupletUnit)),
+        tuplet(qcast(u.tupletTime) * qPerTuplet(u.tupletUnit, u.tupletCount))
+      { sequence = qcast(u.numberMeasures) * measure; }
 
-  t.sequence  = sequence;
-  t.measure   = measure;
+    inline q_t forOutput(OutputMode m) const
+      { return qForOutput(m, sequence, measure, beat, tuplet); }
+  };
+
+  void computeTiming(const State& s, Timing& t) {
+    Sources src(s.settings);
+
+    t.sequence  = src.sequence;
+    t.measure   = src.measure;
+    t.beatUnit  = qPerBeatUnit(s.settings.beatUnit);
+
+    t.periodS   = src.sequence; // S is always the sequence, its timer drives
+                                // the measure interrupts
+    t.periodM   = applyFactor(s.outputFactorM, src.forOutput(s.outputModeM));
+    t.periodB   = applyFactor(s.outputFactorB, src.forOutput(s.outputModeB));
+    t.periodT   = applyFactor(s.outputFactorT, src.forOutput(s.outputModeT));
+      // factors can make periods too long for the timers, see quantumShift()
+
+    auto swing16 = swingQ16(s.swing);
+    swingPeriods(swing16, t.periodB, t.cycleB, t.swungB);
+    swingPeriods(swing16, t.periodT, t.cycleT, t.swungT);
+
+    // swung widths fit the shorter period of the pair
+    t.widthS    = qForWidth(s.pulseWidthS,  t.periodS);
+    t.widthM    = qForWidth(s.pulseWidthM,  t.periodM);
+    t.widthB    = qForWidth(s.pulseWidthB,
+                    t.swungB ? t.cycleB - t.swungB : t.periodB);
+    t.widthT    = qForWidth(s.pulseWidthT,
+                    t.swungT ? t.cycleT - t.swungT : t.periodT);
+  }
+
+  bool fitShift(const Timing& t, uint8_t& shift) {
+    for (shift = 0; shift <= maxQuantumShift; ++shift) {
+      q_t mask = (q_t(1) << shift) - 1;
+      bool even = ((t.sequence | t.measure | t.periodM | t.periodB | t.periodT
+        | t.swungB | t.swungT) & mask) == 0;
+
+      if (even
+          && t.sequence <= maxNumberMeasures * t.measure
+          && (t.periodS >> shift) <= maxTCCPeriod
+          && (t.periodM >> shift) <= maxTCCPeriod
+          && (max(t.periodB, t.swungB) >> shift) <= maxTCPeriod
+          && (max(t.periodT, t.swungT) >> shift) <= maxTCCPeriod)
+        return true;
+    }
+    return false;
+  }
 
-  t.periodS   = sequence;
-  t.periodM   = measure;
-  t.periodB   = beat;
-  t.periodT   = tuplet;
+  bool swingPairsFit(const Timing& t) {
+    // Counts run over the pair from the start of each sequence, see
+    // adjustOffsets(), so the sequence must hold whole pairs. Otherwise the
+    // pair would flip from one sequence to the next.
+    return (!t.swungB || t.sequence % t.cycleB == 0)
+      && (!t.swungT || t.sequence % t.cycleT == 0);
+  }
+}
 
-  t.widthS    = qForWidth(s.pulseWidthS,  t.periodS);
-  t.widthM    = qForWidth(s.pulseWidthM,  t.periodM);
-  t.widthB    = qForWidth(s.pulseWidthB,  t.periodB);
-  t.widthT    = qForWidth(s.pulseWidthT,  t.periodT);
+void computePeriods(const State& s, Timing& t) {
+  computeTiming(s, t);
 
   if (configuration.debug.timing) {
     Serial.println("computed new periods:");
@@ -98,22 +321,58 @@ void computePeriods(const State& s, Timing& t) {
   }
 }
 
-void adjustOffsets(const Timing& t, Offsets& offsets) {
-  q_t now = offsets.countS % t.sequence;
+q_t measureAfter(q_t position, q_t measure, q_t sequence) {
+  auto m = measure ? (position - position % measure) + measure : 0;
+  return m < sequence ? m : 0;
+}
 
-  if (configuration.debug.timing) {
-    Serial.println("old offsets:");
-    dumpOffsets(offsets);
+uint8_t quantumShift(const Timing& t) {
+  uint8_t shift;
+  if (fitShift(t, shift))
+    return shift;
+
+  // should never happen!
+  critical.printf("Periods don't fit the timers\n");
+  return maxQuantumShift;
+}
+
+bool outputsFit(const State& s) {
+  Sources src(s.settings);
+  if (!factorDivides(s.outputFactorM, src.forOutput(s.outputModeM))
+      || !factorDivides(s.outputFactorB, src.forOutput(s.outputModeB))
+      || !factorDivides(s.outputFactorT, src.forOutput(s.outputModeT)))
+    return false;
+
+  Timing t;
+  computeTiming(s, t);
+  uint8_t shift;
+  return swingPairsFit(t) && fitShift(t, shift);
+}
+
+void fitOutputs(State& s) {
+  // drop swing if the sequence doesn't hold whole pairs, then factors, the
+  // least significant output first, until it fits
+  Timing t;
+  computeTiming(s, t);
+  if (!swingPairsFit(t))
+    s.swing = swingNone;
+
+  OutputFactor* factors[] =
+    { &s.outputFactorT, &s.outputFactorB, &s.outputFactorM };
+  for (auto f : factors) {
+    if (outputsFit(s))
+      return;
+    *f = outputFactorNone;
   }
+}
+
+void adjustOffsets(const Timing& t, Offsets& offsets) {
+  // also called from the capture interrupt, so no debug output here
+  q_t now = offsets.countS % t.sequence;
 
   offsets.countS = now % t.periodS;
   offsets.countM = now % t.periodM;
-  offsets.countB = now % t.periodB;
-  offsets.countT = now % t.periodT;
-
-  if (configuration.debug.timing) {
-    Serial.println("new offsets:");
-    dumpOffsets(offsets);
-  }
+  offsets.countB = now % t.cycleB;
+  offsets.countT = now % t.cycleT;
 }
 
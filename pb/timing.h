@@ -28,6 +28,7 @@ inline q_t qcast(const T& x) { return static_cast<q_t>(x); }
 struct Timing {
   q_t   sequence;
   q_t   measure;
+  q_t   beatUnit; // the note value the measure counts, which divides both
 
   q_t   periodS;  // must always be the same as sequence
   q_t   periodM;
@@ -38,9 +39,16 @@ struct Timing {
   q_t   widthM;
   q_t   widthB;
   q_t   widthT;
+
+  // Swing alternates B & T between a longer then a shorter period.
+  q_t   cycleB;   // counts run over this: the period, or two when swung
+  q_t   cycleT;
+  q_t   swungB;   // the first, longer, period of a swung pair, else zero
+  q_t   swungT;
 };
 
 struct Offsets {
+  // counts for swung outputs run over the whole pair of periods
   q_t   countS;
   q_t   countM;
   q_t   countB;
@@ -52,9 +60,32 @@ void computePeriods(const State& state, Timing& timing);
 
 void adjustOffsets(const Timing& periods, Offsets& offsets);
 
+q_t measureAfter(q_t position, q_t measure, q_t sequence);
+  // the start of the next measure, or zero if that is the end of the sequence
+
+const uint8_t maxQuantumShift = 3;
+
+const uint8_t maxNumberMeasures = 8;
+  // as the UI offers, and as many as the measure interrupt's table holds,
+  // see timer_hw.cpp
+
+uint8_t quantumShift(const Timing&);
+  // How far the periods must be shifted down to fit the timers, which then
+  // count every 2^shift Q. Zero unless output factors slow the outputs
+  // beyond the settings, and then at some cost in resolution.
+
+bool outputsFit(const State&);
+  // True if each output factor divides its source period exactly, the
+  // sequence holds whole swung pairs, and the periods fit the timers. The
+  // UI only offers output modes, factors, and swing for which this holds.
+void fitOutputs(State&);
+  // drops swing and output factors until outputsFit(), for when other
+  // settings change
+
 
 
 typedef uint16_t bpm_t;
+typedef uint32_t bpm100_t;    // in hundredths of a BPM
 
 const bpm_t bpmMin = 30;
 const bpm_t bpmMax = 300;
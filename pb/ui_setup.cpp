@@ -62,3 +62,77 @@ void PulseWidthField::redraw() {
   display.drawBitmap(x, y, bitmap, 15, 12, foreColor());
   valueAsDrawn = value;
 }
+
+
+OutputModeField::OutputModeField(
+    int16_t x, int16_t y, uint16_t w, uint16_t h,
+    OutputMode& value, const std::initializer_list<OutputMode>& options
+    )
+    : OutputField(x, y, w, h, value, options)
+    { }
+
+void OutputModeField::redraw() {
+  const char* label;
+
+  switch (value) {
+    case outputSequence:  label = "S";    break;
+    case outputMeasure:   label = "M";    break;
+    case outputBeat:      label = "B";    break;
+    case otuputTuplet:    label = "T";    break;
+
+    case outputFixed4:    label = "4";    break;
+    case outputFixed8:    label = "8";    break;
+    case outputFixed16:   label = "16";   break;
+    case outputFixed32:   label = "32";   break;
+
+    default:              label = "?";    break;
+  }
+
+  smallText();
+  display.setTextColor(foreColor());
+  centerText(label, x, y, w, h);
+  resetText();
+  valueAsDrawn = value;
+}
+
+
+OutputFactorField::OutputFactorField(
+    int16_t x, int16_t y, uint16_t w, uint16_t h,
+    OutputFactor& value
+    )
+    : OutputField(x, y, w, h, value,
+        { -8, -6, -4, -3, -2, outputFactorNone, 2, 3, 4, 6, 8 })
+    { }
+
+void OutputFactorField::redraw() {
+  if (value == outputFactorNone || value == 1 || value == -1) {
+    // unmodified, just the dot of the output jack
+    display.fillCircle(x + w / 2, y + 3, 2, foreColor());
+  } else {
+    char label[3] = { value < 0 ? '/' : 'x', char('0' + abs(value)), 0 };
+
+    smallText();
+    display.setTextColor(foreColor());
+    centerText(label, x, y, w, h);
+    resetText();
+  }
+  valueAsDrawn = value;
+}
+
+
+SwingField::SwingField(
+    int16_t x, int16_t y, uint16_t w, uint16_t h,
+    uint8_t& value
+    )
+    : OutputField(x, y, w, h, value,
+        { swingNone, 54, 58, 62, 66, 71, swingMax })
+    { }
+
+void SwingField::redraw() {
+  display.setTextColor(foreColor());
+  if (value == swingNone || value == 50)
+    centerText("-", x, y, w, h);
+  else
+    centerNumber(value, x, y, w, h);
+  valueAsDrawn = value;
+}
@@ -2,9 +2,41 @@
 #define _INCLUDE_UI_SETUP_H_
 
 #include "state.h"
+#include "timing.h"
 #include "ui_field.h"
 
 
+// A field of an output's settings, which skips over the options that
+// wouldn't fit with the rest of the user's state, see outputsFit().
+
+template< typename T >
+class OutputField : public ValueField<T> {
+public:
+  OutputField(
+      int16_t x, int16_t y, uint16_t w, uint16_t h,
+      T& value, const std::initializer_list<T>& options
+      )
+    : ValueField<T>(x, y, w, h, value, options)
+    { }
+
+  virtual void update(Encoder::Update);
+};
+
+template< typename T >
+void OutputField<T>::update(Encoder::Update update) {
+  T was = this->value;
+  for (int i = 0; i < this->numOptions; ++i) {
+    T before = this->value;
+    ValueField<T>::update(update);
+    if (this->value == before)
+      break;    // no more options in this direction
+    if (outputsFit(userState()))
+      return;
+  }
+  this->value = was;
+}
+
+
 class PulseWidthField : public ValueField<PulseWidth> {
 public:
   PulseWidthField(
@@ -16,4 +48,37 @@ protected:
   virtual void redraw();
 };
 
+class OutputModeField : public OutputField<OutputMode> {
+public:
+  OutputModeField(
+      int16_t x, int16_t y, uint16_t w, uint16_t h,
+      OutputMode& value, const std::initializer_list<OutputMode>& options
+      );
+
+protected:
+  virtual void redraw();
+};
+
+class OutputFactorField : public OutputField<OutputFactor> {
+public:
+  OutputFactorField(
+      int16_t x, int16_t y, uint16_t w, uint16_t h,
+      OutputFactor& value
+      );
+
+protected:
+  virtual void redraw();
+};
+
+class SwingField : public OutputField<uint8_t> {
+public:
+  SwingField(
+      int16_t x, int16_t y, uint16_t w, uint16_t h,
+      uint8_t& value
+      );
+
+protected:
+  virtual void redraw();
+};
+
 #endif // _INCLUDE_UI_SETUP_H_
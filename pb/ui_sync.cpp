@@ -1,7 +1,10 @@
 #include "ui_sync.h"
 
+#include <Arduino.h>
+
 #include "display.h"
 #include "layout.h"
+#include "midi.h"
 #include "timer_hw.h"
 
 
@@ -72,6 +75,12 @@ namespace SyncImages {
     0x00, 0x00, 0x07, 0xc0, 0x0f, 0xe0, 0x0c, 0x60, 0x08, 0x60, 0x00, 0xe0, 0x01, 0xc0, 0x03, 0x80,
     0x03, 0x80, 0x00, 0x00, 0x03, 0x80, 0x03, 0x80, 0x03, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   };
+  const unsigned char clkauto[] = { // 15 x 32
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3f, 0x00, 0x3f, 0x00, 0x21, 0x00,
+    0x21, 0x00, 0x21, 0x08, 0x01, 0x08, 0x01, 0x08, 0x01, 0xf8, 0x01, 0xf8, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x00, 0x03, 0x80, 0x03, 0x80, 0x06, 0xc0, 0x06, 0xc0, 0x0c, 0x60, 0x0f, 0xe0,
+    0x0f, 0xe0, 0x0c, 0x60, 0x0c, 0x60, 0x0c, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  };
   const unsigned char fixed[] = { // 15 x 32
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x03, 0x80, 0x02, 0x84, 0x02, 0x98, 0x05, 0x58, 0x04, 0x60,
@@ -102,6 +111,41 @@ void BpmField::enter(bool alternate) {
 }
 
 
+void BpmField::exit() {
+  tapTempo.reset();
+}
+
+namespace {
+  // if true, tapping also moves the beat to line up with the taps
+  const bool tapAlignsBeat = true;
+}
+
+bool BpmField::click(Button::State s) {
+  // While the field is entered, each press is a tap. Taps are timed from
+  // the press, but only take effect on release: A long press leaves the
+  // field instead.
+  switch (s) {
+    case Button::Down:
+      tapDownAt = micros();
+      return true;
+
+    case Button::Up:
+      tapTempo.tap(tapDownAt);
+      if (tapTempo.ready()) {
+        setBeatPeriod(tapTempo.interval());
+        if (tapAlignsBeat)
+          alignBeat(micros() - tapTempo.lastTap());
+      }
+      return true;
+
+    case Button::DownLong:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
 void BpmField::update(Encoder::Update update) {
   auto status = ClockStatus::current();
 
@@ -186,7 +230,10 @@ namespace {
     { sync8ppqn,  SyncImages::clk32 },
     { sync24ppqn, SyncImages::din24 },
     { sync48ppqn, SyncImages::din48 },
-    // { syncMidi,   SyncImages::usbmidi },
+    { syncAuto,   SyncImages::clkauto },
+#if PB_MIDI_USB
+    { syncMidiUSB, SyncImages::usbmidi },
+#endif
   };
 
   const int numSyncOptions = sizeof(syncOptions) / sizeof(syncOptions[0]);
@@ -3,6 +3,7 @@
 
 #include "clock.h"
 #include "state.h"
+#include "tap_tempo.h"
 #include "timing.h"
 #include "ui_field.h"
 
@@ -14,6 +15,9 @@ public:
     { }
 
     virtual void enter(bool);
+    virtual void exit();
+
+    virtual bool click(Button::State);
     virtual void update(Encoder::Update);
 
 protected:
@@ -24,6 +28,9 @@ private:
     State& state;
 
     ClockStatus clockAsDrawn;
+
+    TapTempo tapTempo;
+    uint32_t tapDownAt;
 };
 
 